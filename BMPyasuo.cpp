@@ -4,6 +4,17 @@
 #include <cstdint>
 #include <string>
 #include <iomanip>  // setprecision
+#include <cstring>
+#include <span>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "mapped_file.h"
+#include "batch_cli.h"
+#include "rle.h"
+#include "palette.h"
+#include "bmp_layout.h"
+#include "stage_stats.h"
 
 #pragma pack(push, 1)
 struct BITMAPFILEHEADER {
@@ -29,102 +40,390 @@ struct BITMAPINFOHEADER {
 };
 #pragma pack(pop)
 
-uint8_t getPixel(const std::vector<uint8_t>& shuju, int kuandu, int x, int y, int gaodu) {
-    int meihangZijie = (kuandu + 1) / 2;
-    int hangIndex = gaodu - 1 - y;
-    int zijieIndex = hangIndex * meihangZijie + x / 2;
-    uint8_t zijie = shuju[zijieIndex];
+// RLE1/RLE4/RLE8 by bit count, reading the rows in place. Rows are encoded in parallel stripes on
+// pool (see rle.h), or serially into out when pool is null (batch mode runs files in parallel instead)
+void encodeImage(int bpp, RowView rows, int width, int height, ThreadPool* pool, std::vector<uint8_t>& out) {
+    if (pool) out = encodeRLEParallel(bpp, rows, width, height, *pool);
+    else encodeRLE(bpp, rows, width, height, out);
+}
 
-    uint8_t result;
-    if (x % 2 == 0) result = zijie >> 4;
-    else result = zijie & 0x0F;
+std::uintmax_t getFileSize(const std::string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+    if (!file) return 0;
+    return static_cast<std::uintmax_t>(file.tellg());
+}
 
-    return result;
+// Headers of a mapped BMP and views of its palette and pixels inside the mapping (see bmp_layout.h).
+struct BmpView {
+    BITMAPFILEHEADER fileHeader;
+    BITMAPINFOHEADER infoHeader;  // biHeight is made positive: output is always stored bottom-up
+    std::span<const uint8_t> palette, data;
+    RowView rows;     // uncompressed rows, bottom-up
+    bool compressed;  // biCompression is the RLE code for this bit count
+};
+
+// trueColor also admits uncompressed 24-bit images (for the palette preprocessor).
+bool parseBmp(std::span<const uint8_t> bytes, BmpView& bmp, std::string& error, bool trueColor = false) {
+    BmpLayout layout;
+    const char* message = nullptr;
+    if (!parseBmpLayout(bytes, layout, message)) {
+        error = message;
+        return false;
+    }
+    if (layout.bpp == 24 && !trueColor) {
+        error = "Поддерживаются только 1-, 4- и 8-битные BMP изображения с палитрой.";
+        return false;
+    }
+    std::memcpy(&bmp.fileHeader, bytes.data(), sizeof(bmp.fileHeader));
+    std::memcpy(&bmp.infoHeader, bytes.data() + sizeof(bmp.fileHeader), sizeof(bmp.infoHeader));
+    bmp.infoHeader.biSize = sizeof(bmp.infoHeader);
+    bmp.infoHeader.biHeight = layout.height;
+    bmp.palette = layout.palette;
+    bmp.data = layout.data;
+    bmp.rows = layout.rows();
+    bmp.compressed = layout.compressed();
+    return true;
 }
 
-// RLE4 
-std::vector<uint8_t> encodeRLE4(const std::vector<uint8_t>& data, int width, int height) {
-    std::vector<uint8_t> encoded;
-    for (int y = height - 1; y > 0; y--) {
-        int x = 0;
-        while (x < width) {
-            uint8_t color = getPixel(data, width, x, y, height);
-            int count = 1;
-            while (x + count < width && getPixel(data, width, x + count, y, height) == color && count < 255)
-                count++;
-            encoded.push_back(count);
-            encoded.push_back((color << 4) | color);
-            x += count;
-        }
-        encoded.push_back(0);
-        encoded.push_back(0);
+// Writes the headers and palette of bmp followed by data stored with the given biCompression.
+bool writeBmp(const std::string& outputFile, BmpView bmp, uint32_t compression, const std::vector<uint8_t>& data,
+              std::string& error) {
+    StageTimer timer(STAGE_WRITE);
+    std::ofstream fout(outputFile.c_str(), std::ios::binary);
+    if (!fout) {
+        error = "Не удалось создать выходной файл.";
+        return false;
+    }
+
+    bmp.infoHeader.biCompression = compression;
+    bmp.infoHeader.biSizeImage = data.size();
+    bmp.fileHeader.bfOffBits = sizeof(bmp.fileHeader) + sizeof(bmp.infoHeader) + bmp.palette.size();
+    bmp.fileHeader.bfSize = bmp.fileHeader.bfOffBits + data.size();
+
+    fout.write(reinterpret_cast<char*>(&bmp.fileHeader), sizeof(bmp.fileHeader));
+    fout.write(reinterpret_cast<char*>(&bmp.infoHeader), sizeof(bmp.infoHeader));
+    fout.write(reinterpret_cast<const char*>(bmp.palette.data()), bmp.palette.size());
+    fout.write(reinterpret_cast<const char*>(data.data()), data.size());
+    fout.close();
+    if (!fout) {
+        error = "Не удалось записать выходной файл.";
+        return false;
     }
-    encoded.push_back(0);
-    encoded.push_back(1);
-    return encoded;
+    stageCount(STAT_BYTES_OUT, bmp.fileHeader.bfSize);
+    return true;
 }
 
-std::uintmax_t getFileSize(const std::string& filename) {
-    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
-    if (!file) return 0;
-    return static_cast<std::uintmax_t>(file.tellg());
+// Writes index as the row index sidecar OUTPUT.idx for tile decoding (RLERowIndex in rle.h).
+bool saveRowIndex(const std::string& outputFile, const RLERowIndex& index, std::string& error) {
+    std::vector<uint8_t> bytes;
+    writeRLERowIndex(index, bytes);
+    std::ofstream fout((outputFile + ".idx").c_str(), std::ios::binary);
+    fout.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    fout.close();
+    if (!fout) {
+        error = "Не удалось записать индекс строк.";
+        return false;
+    }
+    stageCount(STAT_BYTES_OUT, bytes.size());
+    return true;
 }
 
-int main() {
-    std::string inputFile, outputFile;
-    std::cout << "Введите имя входного BMP файла: ";
-    std::cin >> inputFile;
+// Row index sidecar OUTPUT.idx for the encoded stream, every step-th row.
+bool writeRowIndex(const std::string& outputFile, int bpp, const std::vector<uint8_t>& encoded, int rows, int step,
+                   std::string& error) {
+    StageTimer timer(STAGE_INDEX);
+    RLERowIndex index;
+    if (!makeRLERowIndex(bpp, encoded, rows, step, index)) {
+        error = "Не удалось построить индекс строк.";
+        return false;
+    }
+    return saveRowIndex(outputFile, index, error);
+}
 
-    std::ifstream fin(inputFile.c_str(), std::ios::binary);
-    if (!fin) {
-        std::cerr << "Не удалось открыть входной файл.\n";
+// Index step for the output of -u: that of OLD_RLE.bmp.idx if it reads, otherwise that of an OUT.bmp.idx
+// left over from an earlier run (1 if unreadable), which would describe the old stream; 0 - no index.
+int updateIndexStep(const std::string& oldRleFile, size_t streamSize, const std::string& outputFile) {
+    RLERowIndex index;
+    MappedInput input;
+    if (input.open(oldRleFile + ".idx") && readRLERowIndex(input.bytes(), streamSize, index)) return index.step;
+    if (!input.open(outputFile + ".idx")) return 0;
+    return readRLERowIndex(input.bytes(), SIZE_MAX, index) ? index.step : 1;
+}
+
+// Compresses an uncompressed indexed BMP or unpacks an RLE one back to BI_RGB. With indexStep > 0
+// a compressed result also gets a row index sidecar. optimizePalette rebuilds the palette before
+// encoding (reducePalette in palette.h) and also admits 24-bit input with up to 256 colors.
+// encoded is the caller's buffer and keeps its capacity; on failure error holds the message.
+bool processFile(const std::string& inputFile, const std::string& outputFile, ThreadPool* pool,
+                 std::vector<uint8_t>& encoded, bool& decompress, std::string& error, int indexStep = 0,
+                 bool optimizePalette = false) {
+    if (sameFile(inputFile, outputFile)) {
+        error = "Выходной файл совпадает с входным.";
+        return false;
+    }
+    MappedInput input;  // memory-mapped, pixels are read in place
+    bool opened;
+    {
+        StageTimer timer(STAGE_READ);
+        opened = input.open(inputFile);
+    }
+    if (!opened) {
+        error = "Не удалось открыть входной файл.";
+        return false;
+    }
+    stageCount(STAT_BYTES_IN, input.bytes().size());
+    BmpView bmp;
+    bool parsed;
+    {
+        StageTimer timer(STAGE_PARSE);
+        parsed = parseBmp(input.bytes(), bmp, error, optimizePalette);
+    }
+    if (!parsed) return false;
+    int bpp = bmp.infoHeader.biBitCount, width = bmp.infoHeader.biWidth, height = bmp.infoHeader.biHeight;
+    decompress = bmp.compressed;  // RLE input is decoded back to raw pixels
+    stageCount(STAT_SYMBOLS, uint64_t(width) * uint64_t(height));
+    IndexedImage reduced;
+    if (!decompress && optimizePalette) {
+        StageTimer timer(STAGE_PALETTE);
+        if (!reducePalette(bpp, bmp.palette, bmp.rows, width, height, reduced)) {
+            error = "В 24-битном изображении больше 256 цветов.";
+            return false;
+        }
+        bpp = reduced.bpp;
+        bmp.rows = RowView(reduced.pixels, (size_t(width) * bpp + 7) / 8);
+        bmp.palette = reduced.palette;
+        bmp.infoHeader.biBitCount = uint16_t(bpp);
+        bmp.infoHeader.biClrUsed = bmp.infoHeader.biClrImportant = uint32_t(reduced.palette.size() / 4);
+    }
+
+    if (decompress) {
+        size_t stride = (size_t(width) * bpp + 31) / 32 * 4;  // raw BMP rows are padded to 4 bytes
+        StageTimer timer(STAGE_DECODE);
+        if (activeStageStats()) stageCount(STAT_RUNS, countRLERuns(bpp, bmp.data));
+        if (!decodeRLE(bpp, bmp.data, width, height, stride, encoded)) {
+            error = "Файл повреждён: ошибка в данных RLE.";
+            return false;
+        }
+    }
+    else {
+        StageTimer timer(STAGE_ENCODE);
+        encodeImage(bpp, bmp.rows, width, height, pool, encoded);
+        if (activeStageStats()) stageCount(STAT_RUNS, countRLERuns(bpp, encoded));
+    }
+    if (!writeBmp(outputFile, bmp, decompress ? BI_RGB : rleCompression(bpp), encoded, error)) return false;
+    return decompress || indexStep <= 0 || writeRowIndex(outputFile, bpp, encoded, height, indexStep, error);
+}
+
+// Incremental update: BMPyasuo -u OLD.bmp OLD_RLE.bmp NEW.bmp OUT.bmp, where OLD_RLE.bmp is this
+// tool's output for OLD.bmp. Rows of NEW that differ from OLD are re-encoded, the rest are copied
+// from OLD_RLE.bmp's stream (see updateRLE in rle.h), so the cost follows the size of the edit.
+// Copied and re-encoded rows must share one index space, so all three palettes must be identical:
+// an output of batch mode with -p is accepted only if the rebuild left the palette unchanged.
+// OUT.bmp must differ from the inputs, which stay mapped until it is written. If OLD_RLE.bmp or
+// OUT.bmp has a row index, OUT.bmp.idx is rewritten from the row offsets updateRLE returns.
+int runUpdate(char* argv[]) {
+    const char* names[3] = { argv[0], argv[1], argv[2] };
+    MappedInput inputs[3];
+    BmpView bmp[3];
+    std::string error;
+    for (int k = 0; k < 3; ++k) {
+        if (sameFile(names[k], argv[3])) {
+            std::cerr << argv[3] << ": выходной файл совпадает с входным " << names[k] << ".\n";
+            return 1;
+        }
+    }
+    for (int k = 0; k < 3; ++k) {
+        if (!inputs[k].open(names[k])) {
+            std::cerr << names[k] << ": Не удалось открыть входной файл.\n";
+            return 1;
+        }
+        if (!parseBmp(inputs[k].bytes(), bmp[k], error)) {
+            std::cerr << names[k] << ": " << error << "\n";
+            return 1;
+        }
+    }
+    const BITMAPINFOHEADER &oldInfo = bmp[0].infoHeader, &newInfo = bmp[2].infoHeader;
+    for (int k : { 1, 2 }) {
+        const BITMAPINFOHEADER& info = bmp[k].infoHeader;
+        if (info.biWidth != oldInfo.biWidth || info.biHeight != oldInfo.biHeight ||
+            info.biBitCount != oldInfo.biBitCount) {
+            std::cerr << names[k] << ": размеры или глубина цвета не совпадают с " << names[0] << "\n";
+            return 1;
+        }
+        // copied rows keep OLD_RLE.bmp's indices and OUT.bmp gets NEW.bmp's palette
+        if (!samePalette(bmp[k].palette, bmp[0].palette)) {
+            std::cerr << names[k] << ": палитра не совпадает с " << names[0]
+                      << " (сжатые с -p файлы годятся, только если палитра не изменилась)\n";
+            return 1;
+        }
+    }
+    if (bmp[0].compressed || !bmp[1].compressed || bmp[2].compressed) {
+        std::cerr << "Ожидаются несжатые старый и новый файлы и сжатый старый.\n";
         return 1;
     }
 
-    BITMAPFILEHEADER fileHeader;
-    fin.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
-    if (fileHeader.bfType != 0x4D42) {
-        std::cerr << "Это не корректный BMP файл.\n";
+    int bpp = newInfo.biBitCount, width = newInfo.biWidth, height = newInfo.biHeight;
+    std::vector<size_t> rowOffsets;
+    std::vector<uint8_t> encoded;
+    long changed = updateRLE(bpp, bmp[0].rows, bmp[2].rows, width, height, bmp[1].data, rowOffsets, encoded);
+    if (changed < 0) {
+        std::cerr << names[1] << ": RLE-поток не разбивается на строки изображения.\n";
+        return 1;
+    }
+    if (!writeBmp(argv[3], bmp[2], rleCompression(bpp), encoded, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    RLERowIndex index;
+    int step = updateIndexStep(names[1], bmp[1].data.size(), argv[3]);
+    if (step > 0 && !(sampleRLERowIndex(rowOffsets, step, index) && saveRowIndex(argv[3], index, error))) {
+        std::cerr << (error.empty() ? "Не удалось построить индекс строк." : error) << "\n";
         return 1;
     }
+    std::cout << "Перекодировано строк: " << changed << " из " << height << ", создан файл: " << argv[3] << "\n";
+    return 0;
+}
 
-    BITMAPINFOHEADER infoHeader;
-    fin.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-    if (infoHeader.biBitCount != 4) {
-        std::cerr << "Поддерживаются только 4-битные (16 цветов) BMP изображения.\n";
+// Tile extraction: BMPyasuo -t X Y W H IN.bmp OUT.bmp cuts the W x H rectangle with its top-left
+// pixel at (X, Y), counted from the top-left corner, out of an RLE-compressed IN.bmp into an
+// uncompressed OUT.bmp. Only the tile's rows are decoded, in parallel; their offsets come from
+// IN.bmp.idx when it exists (batch -i), otherwise from one pass over the command headers.
+int runTile(char* argv[]) {
+    int rect[4];
+    for (int k = 0; k < 4; ++k) {
+        char* end = nullptr;
+        long v = std::strtol(argv[k], &end, 10);
+        if (*end != 0 || v < 0 || v > 0x7FFFFFFF) {
+            std::cerr << "Неверная координата: " << argv[k] << "\n";
+            return 2;
+        }
+        rect[k] = int(v);
+    }
+    std::string inputFile = argv[4], outputFile = argv[5], error;
+    if (sameFile(inputFile, outputFile)) {
+        std::cerr << "Выходной файл совпадает с входным.\n";
+        return 1;
+    }
+    MappedInput input;
+    BmpView bmp;
+    if (!input.open(inputFile)) {
+        std::cerr << "Не удалось открыть входной файл.\n";
+        return 1;
+    }
+    if (!parseBmp(input.bytes(), bmp, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    int bpp = bmp.infoHeader.biBitCount, width = bmp.infoHeader.biWidth, height = bmp.infoHeader.biHeight;
+    int x = rect[0], y = rect[1], w = rect[2], h = rect[3];
+    if (!bmp.compressed || w == 0 || h == 0 || x > width - w || y > height - h) {
+        std::cerr << "Фрагмент должен лежать внутри сжатого изображения.\n";
         return 1;
     }
 
-    int paletteSize = 16 * 4;
-    std::vector<uint8_t> palette(paletteSize);
-    fin.read(reinterpret_cast<char*>(&palette[0]), paletteSize);
+    RLERowIndex index;
+    MappedInput sidecar;
+    if (!(sidecar.open(inputFile + ".idx") && readRLERowIndex(sidecar.bytes(), bmp.data.size(), index) &&
+          index.rows == height) &&
+        !makeRLERowIndex(bpp, bmp.data, height, 16, index)) {
+        std::cerr << "Файл повреждён: RLE-поток не разбивается на строки.\n";
+        return 1;
+    }
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<uint8_t> tile;
+    size_t stride = (size_t(w) * bpp + 31) / 32 * 4;  // raw BMP rows are padded to 4 bytes
+    // rows are stored bottom-up
+    if (!decodeRLERect(bpp, bmp.data, index, width, x, height - y - h, w, h, stride, &pool, tile)) {
+        std::cerr << "Файл повреждён: ошибка в данных RLE.\n";
+        return 1;
+    }
+    bmp.infoHeader.biWidth = w;
+    bmp.infoHeader.biHeight = h;
+    if (!writeBmp(outputFile, bmp, BI_RGB, tile, error)) {
+        std::cerr << error << "\n";
+        return 1;
+    }
+    std::cout << "Фрагмент " << w << "x" << h << " записан в " << outputFile << "\n";
+    return 0;
+}
 
-    int dataSize = fileHeader.bfSize - fileHeader.bfOffBits;
-    std::vector<uint8_t> imageData(dataSize);
-    fin.read(reinterpret_cast<char*>(&imageData[0]), dataSize);
-    fin.close();
+// Batch mode: BMPyasuo [-j N] [-i[STEP]] [-p] [-m] -o DIR files, directories, globs, @list. Results
+// keep their relative names under DIR; each file is encoded on one thread and the output buffer stays
+// with the thread. -i writes a row index sidecar for every STEP-th row (every row by default) next to
+// each compressed result; -p rebuilds the palette before encoding; -m prints a stage statistics line
+// per file to stderr (stage_stats.h). The file does not record that -p renumbered the colors: such a
+// result serves as the OLD_RLE.bmp of -u only when the palette came out unchanged (runUpdate
+// compares the palettes).
+int runBatchMode(int argc, char* argv[]) {
+    BatchOptions opt;
+    std::string error;
+    int indexStep = 0;
+    bool optimizePalette = false, collectStats = false;
+    bool flagsOk = parseBatchArgs(argc, argv, opt, error);
+    for (const std::string& flag : opt.flags) {
+        if (flag == "-p") {
+            optimizePalette = true;
+            continue;
+        }
+        if (flag == "-m") {
+            collectStats = true;
+            continue;
+        }
+        char* end = nullptr;
+        long step = flag.size() == 2 ? 1 : std::strtol(flag.c_str() + 2, &end, 10);
+        if (flag.compare(0, 2, "-i") != 0 || (end && *end != 0) || step < 1 || step > 65536) flagsOk = false;
+        else indexStep = int(step);
+    }
+    if (!flagsOk || opt.inputs.empty() || opt.outDir.empty()) {
+        if (!error.empty()) std::cerr << error << "\n";
+        std::cerr << "Использование: BMPyasuo [-j N] [-i[шаг]] [-p] [-m] -o каталог файлы, каталоги, шаблоны, @список\n"
+                  << "               (-p перестраивает палитру; такие результаты не годятся основой для -u,\n"
+                  << "                если палитра изменилась)\n";
+        return 2;
+    }
+    return runBatch(opt, ".bmp", [&](const BatchFile& file, BatchReport& report) {
+        thread_local std::vector<uint8_t> encoded;
+        std::string outputFile = batchOutputBase(file, opt.outDir);
+        bool decompress = false;
+        std::string message;
+        StageStats stats;
+        StageScope scope(collectStats ? &stats : nullptr);
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = processFile(file.path, outputFile, nullptr, encoded, decompress, message, indexStep, optimizePalette);
+        if (collectStats) {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            printStageStats(std::cerr, "BMPyasuo", decompress ? "decompress" : "compress", file.path, ok, seconds,
+                            stats);
+        }
+        if (!ok) return report.fail(file.path, message);
+        report.done(file.size, getFileSize(outputFile));
+    });
+}
 
-    std::vector<uint8_t> encoded = encodeRLE4(imageData, infoHeader.biWidth, infoHeader.biHeight);
+int main(int argc, char* argv[]) {
+    if (argc == 6 && std::string(argv[1]) == "-u") return runUpdate(argv + 2);
+    if (argc == 8 && std::string(argv[1]) == "-t") return runTile(argv + 2);
+    if (argc > 1) return runBatchMode(argc, argv);
 
+    std::string inputFile, outputFile;
+    std::cout << "Введите имя входного BMP файла: ";
+    std::cin >> inputFile;
     std::cout << "Введите имя выходного BMP файла: ";
     std::cin >> outputFile;
 
-    std::ofstream fout(outputFile.c_str(), std::ios::binary);
-    if (!fout) {
-        std::cerr << "Не удалось создать выходной файл.\n";
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<uint8_t> encoded;
+    bool decompress = false;
+    std::string error;
+    if (!processFile(inputFile, outputFile, &pool, encoded, decompress, error)) {
+        std::cerr << error << "\n";
         return 1;
     }
 
-    infoHeader.biCompression = 2; // BI_RLE4
-    infoHeader.biSizeImage = encoded.size();
-    fileHeader.bfSize = fileHeader.bfOffBits + encoded.size();
-
-    fout.write(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
-    fout.write(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-    fout.write(reinterpret_cast<char*>(&palette[0]), paletteSize);
-    fout.write(reinterpret_cast<char*>(&encoded[0]), encoded.size());
-    fout.close();
-
+    if (decompress) {
+        std::cout << "Распаковка завершена! Создан файл: " << outputFile << "\n";
+        return 0;
+    }
     std::cout << "Сжатие завершено! Создан файл: " << outputFile << "\n\n";
 
     std::uintmax_t originalSize = getFileSize(inputFile);
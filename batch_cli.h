@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "job_scheduler.h"
+
+// Пакетный режим утилит без диалога. Входы — файлы, каталоги (обходятся рекурсивно), шаблоны
+// с * и ? в имени файла и списки @файл (один путь в строке). -j N задаёт число потоков,
+// -o КАТАЛОГ — куда писать результаты; остальные параметры вида -x остаются утилите.
+struct BatchOptions {
+    unsigned jobs = 0;  // 0 — по числу аппаратных потоков
+    std::string outDir;
+    std::vector<std::string> inputs;
+    std::vector<std::string> flags;
+};
+
+struct BatchFile {
+    std::string path;
+    std::string relative;  // путь результата внутри выходного каталога
+    std::uintmax_t size;
+};
+
+inline bool parseBatchArgs(int argc, char* argv[], BatchOptions& opt, std::string& error) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" || arg == "-o") {
+            if (i + 1 >= argc) {
+                error = "после " + arg + " нужно значение";
+                return false;
+            }
+            std::string value = argv[++i];
+            if (arg == "-o") {
+                opt.outDir = value;
+                continue;
+            }
+            char* end = nullptr;
+            long n = std::strtol(value.c_str(), &end, 10);
+            if (*end != 0 || n < 1 || n > 4096) {
+                error = "неверное число потоков: " + value;
+                return false;
+            }
+            opt.jobs = unsigned(n);
+        }
+        else if (arg.size() > 1 && arg[0] == '-') opt.flags.push_back(arg);
+        else opt.inputs.push_back(arg);
+    }
+    return true;
+}
+
+// Сопоставление имени с шаблоном: * — любая последовательность, ? — один символ.
+inline bool globMatch(const std::string& pattern, const std::string& name) {
+    size_t p = 0, n = 0, star = std::string::npos, resume = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            p++;
+            n++;
+        }
+        else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = n;
+        }
+        else if (star != std::string::npos) {
+            p = star + 1;
+            n = ++resume;
+        }
+        else return false;
+    }
+    while (p < pattern.size() && pattern[p] == '*') p++;
+    return p == pattern.size();
+}
+
+// extension (например, ".bmp") отбирает файлы при обходе каталогов; явно названные файлы,
+// шаблоны и списки берутся как есть. Пустое extension — все файлы.
+inline bool expandBatchInput(const std::string& input, const std::string& extension,
+                             std::vector<BatchFile>& files, std::string& error) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    if (input.size() > 1 && input[0] == '@') {
+        std::ifstream list(input.substr(1));
+        if (!list) {
+            error = "не удалось открыть список " + input.substr(1);
+            return false;
+        }
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (!line.empty() && !expandBatchInput(line, extension, files, error)) return false;
+        }
+        return true;
+    }
+
+    fs::path path(input);
+    std::string name = path.filename().string();
+    if (name.find_first_of("*?") != std::string::npos) {
+        fs::path dir = path.has_parent_path() ? path.parent_path() : fs::path(".");
+        for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+            std::string entry = it->path().filename().string();
+            if (it->is_regular_file(ec) && globMatch(name, entry))
+                files.push_back({ it->path().string(), entry, it->file_size(ec) });
+        }
+        if (ec) {
+            error = "не удалось прочитать каталог " + dir.string();
+            return false;
+        }
+        return true;
+    }
+
+    if (fs::is_directory(path, ec)) {
+        for (fs::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            if (!it->is_regular_file(ec)) continue;
+            if (!extension.empty() && it->path().extension().string() != extension) continue;
+            files.push_back({ it->path().string(), fs::relative(it->path(), path, ec).string(), it->file_size(ec) });
+        }
+        if (ec) {
+            error = "не удалось обойти каталог " + input;
+            return false;
+        }
+        return true;
+    }
+
+    if (!fs::is_regular_file(path, ec)) {
+        error = "файл не найден: " + input;
+        return false;
+    }
+    files.push_back({ input, name, fs::file_size(path, ec) });
+    return true;
+}
+
+// Путь результата без суффикса: рядом с входом или внутри -o с сохранением подкаталогов.
+inline std::string batchOutputBase(const BatchFile& file, const std::string& outDir) {
+    namespace fs = std::filesystem;
+    if (outDir.empty()) return file.path;
+    fs::path out = fs::path(outDir) / file.relative;
+    std::error_code ec;
+    fs::create_directories(out.parent_path(), ec);
+    return out.string();
+}
+
+// Сводка пакетного прогона; вызывается из рабочих потоков одновременно.
+class BatchReport {
+public:
+    void done(std::uintmax_t inBytes, std::uintmax_t outBytes) {
+        files++;
+        bytesIn += inBytes;
+        bytesOut += outBytes;
+    }
+
+    void fail(const std::string& path, const std::string& message) {
+        failed++;
+        std::lock_guard<std::mutex> lock(m);
+        std::cerr << path << ": " << message << "\n";
+    }
+
+    bool ok() const { return failed == 0; }
+
+    void print(std::ostream& out, unsigned threads, double seconds) const {
+        double in = bytesIn / 1048576.0, outMb = bytesOut / 1048576.0;
+        out << "Файлов: " << files << ", ошибок: " << failed << ", потоков: " << threads << "\n";
+        out << "Вход: " << in << " МБ, выход: " << outMb << " МБ";
+        if (bytesIn > 0) out << " (" << 100.0 * double(bytesOut) / double(bytesIn) << "%)";
+        out << "\n";
+        out << "Время: " << seconds << " с, " << (seconds > 0 ? in / seconds : 0) << " МБ/с, "
+            << (seconds > 0 ? files / seconds : 0) << " файлов/с\n";
+    }
+
+private:
+    std::atomic<std::uintmax_t> files{ 0 }, failed{ 0 }, bytesIn{ 0 }, bytesOut{ 0 };
+    std::mutex m;
+};
+
+// Разворачивает входы, раздаёт файлы планировщику от крупных к мелким и печатает сводку.
+// job(file, report) обрабатывает один файл и сам отмечает успех или ошибку в report; буферы,
+// переживающие отдельный файл, он держит в thread_local. Возвращает код завершения процесса.
+template <class Job>
+int runBatch(const BatchOptions& opt, const std::string& extension, Job job) {
+    std::vector<BatchFile> files;
+    std::string error;
+    for (const std::string& input : opt.inputs) {
+        if (!expandBatchInput(input, extension, files, error)) {
+            std::cerr << error << std::endl;
+            return 2;
+        }
+    }
+    std::stable_sort(files.begin(), files.end(),
+                     [](const BatchFile& a, const BatchFile& b) { return a.size > b.size; });
+
+    JobScheduler scheduler(opt.jobs ? opt.jobs : std::max(1u, std::thread::hardware_concurrency()));
+    BatchReport report;
+    auto t0 = std::chrono::steady_clock::now();
+    scheduler.run(files.size(), [&](size_t i, unsigned) { job(files[i], report); });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    report.print(std::cout, scheduler.size(), seconds);
+    return report.ok() ? 0 : 1;
+}
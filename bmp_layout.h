@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "rle.h"
+
+// Разметка BMP-файла в памяти: размеры, палитра и пиксели как отрезки внутри входа, без копий и
+// без выделения памяти. Пиксели берутся с bfOffBits (между палитрой и ими бывают зазоры, а
+// заголовки V4/V5 длиннее 40 байт), несжатые строки выровнены до 4 байт, изображение с
+// отрицательной biHeight хранится сверху вниз. bfSize не используется: многие программы пишут
+// его неверно, а границы задаёт настоящий размер файла.
+struct BmpLayout {
+    int width = 0, height = 0;  // height всегда положительна
+    int bpp = 0;                // 1, 4, 8 или 24
+    uint32_t compression = BI_RGB;
+    bool topDown = false;             // первой в файле идёт верхняя строка
+    size_t stride = 0;                // байт в строке несжатых пикселей, с выравниванием
+    std::span<const uint8_t> palette;  // по 4 байта на цвет (синий, зелёный, красный, ноль)
+    std::span<const uint8_t> data;     // несжатые пиксели, stride·height байт, или поток RLE
+
+    bool compressed() const { return compression != BI_RGB; }
+
+    // Строки несжатого изображения снизу вверх, в порядке потока RLE, прямо во входе.
+    RowView rows() const {
+        if (!topDown) return RowView(data.data(), ptrdiff_t(stride));
+        return RowView(data.data() + (size_t(height) - 1) * stride, -ptrdiff_t(stride));
+    }
+};
+
+inline uint32_t readLE16(const uint8_t* p) { return uint32_t(p[0]) | uint32_t(p[1]) << 8; }
+inline uint32_t readLE32(const uint8_t* p) { return readLE16(p) | readLE16(p + 2) << 16; }
+
+// Проверяет заголовки и заполняет layout. Каждое поле сверяется с настоящим размером bytes до
+// того, как по нему что-то читается, поэтому ни испорченный, ни обрезанный файл не выводят за
+// границы входа. Допускаются 1-, 4- и 8-битные изображения без сжатия или с RLE своей глубины и
+// 24-битные без сжатия. При ошибке в error — сообщение для пользователя (строковая константа).
+inline bool parseBmpLayout(std::span<const uint8_t> bytes, BmpLayout& layout, const char*& error) {
+    const size_t FILE_HEADER = 14, INFO_HEADER = 40;
+    error = "Это не корректный BMP файл.";
+    if (bytes.size() < FILE_HEADER + INFO_HEADER || readLE16(bytes.data()) != 0x4D42) return false;
+    const uint8_t* info = bytes.data() + FILE_HEADER;
+    uint32_t offBits = readLE32(bytes.data() + 10), infoSize = readLE32(info);
+    // 12-байтный заголовок OS/2 с 3-байтной палитрой не поддерживается
+    if (infoSize < INFO_HEADER || infoSize > bytes.size() - FILE_HEADER) return false;
+
+    int32_t width = int32_t(readLE32(info + 4)), height = int32_t(readLE32(info + 8));
+    int bpp = int(readLE16(info + 14));
+    uint32_t compression = readLE32(info + 16), sizeImage = readLE32(info + 20), colorsUsed = readLE32(info + 32);
+    if (bpp != 1 && bpp != 4 && bpp != 8 && bpp != 24) {
+        error = "Поддерживаются только 1-, 4- и 8-битные BMP изображения с палитрой.";
+        return false;
+    }
+    if (compression != BI_RGB && (bpp == 24 || compression != rleCompression(bpp))) {
+        error = "Неподдерживаемый тип сжатия.";
+        return false;
+    }
+    error = "Файл повреждён: размер данных не совпадает с заголовком.";
+    if (width <= 0 || height == 0 || height == INT32_MIN) return false;
+    if (height < 0 && compression != BI_RGB) {
+        error = "Файл повреждён: сжатое изображение не может храниться сверху вниз.";
+        return false;
+    }
+
+    // biClrUsed == 0 означает полную палитру из 2^biBitCount цветов, а у 24 бит — её отсутствие
+    uint32_t colors = colorsUsed || bpp == 24 ? colorsUsed : 1u << bpp;
+    if (colors > (1u << (bpp == 24 ? 8 : bpp))) {
+        error = "Файл повреждён: слишком большая палитра.";
+        return false;
+    }
+    size_t paletteOffset = FILE_HEADER + infoSize, paletteSize = size_t(colors) * 4;
+    if (offBits < paletteOffset + paletteSize || offBits > bytes.size()) return false;
+
+    layout.width = width;
+    layout.height = height < 0 ? -height : height;
+    layout.bpp = bpp;
+    layout.compression = compression;
+    layout.topDown = height < 0;
+    layout.stride = (size_t(width) * size_t(bpp) + 31) / 32 * 4;
+    layout.palette = bytes.subspan(paletteOffset, paletteSize);
+    size_t available = bytes.size() - offBits;
+    if (compression == BI_RGB) {
+        // деление вместо умножения: stride·height может не поместиться в size_t
+        if (layout.stride > available / size_t(layout.height)) return false;
+        layout.data = bytes.subspan(offBits, layout.stride * size_t(layout.height));
+    }
+    else {
+        if (sizeImage > available) return false;
+        layout.data = bytes.subspan(offBits, sizeImage ? sizeImage : available);
+    }
+    error = nullptr;
+    return true;
+}
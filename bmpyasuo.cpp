@@ -4,6 +4,17 @@
 #include <string>
 #include <cstdint>
 #include <iomanip>
+#include <cstring>
+#include <span>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "mapped_file.h"
+#include "batch_cli.h"
+#include "rle.h"
+#include "palette.h"
+#include "bmp_layout.h"
+#include "stage_stats.h"
 
 #pragma pack(push, 1)
 struct Wenjiantou {
@@ -30,104 +41,392 @@ struct Xinxitou {
 #pragma pack(pop)
 // wenjiantou 14 byte; xinxitou 40 byte; weitushuju
 
-uint8_t getPixel(const std::vector<uint8_t>& shuju, int kuandu, int x, int y, int gaodu) {
-	int meihangzijie = (kuandu + 1) / 2;
-	int hangIndex = gaodu - 1 - y;
-	int zijieIndex = hangIndex * meihangzijie + x / 2;
-	uint8_t zijie = shuju[zijieIndex];
+// Строки читаются прямо из входа и кодируются параллельно полосами на chi (см. rle.h), а без пула —
+// последовательно в jieguo: в пакетном режиме параллельно обрабатываются сами файлы
+void bianmaRLE(int weishu, RowView hang, int kuandu, int gaodu, ThreadPool* chi, std::vector<uint8_t>& jieguo) {
+	if (chi) jieguo = encodeRLEParallel(weishu, hang, kuandu, gaodu, *chi);
+	else encodeRLE(weishu, hang, kuandu, gaodu, jieguo);
+}
+
+std::uintmax_t huoquwenjiandaxiao(const std::string& wenjianming) {
+	std::ifstream wenjian(wenjianming.c_str(), std::ios::binary | std::ios::ate);
+	if (!wenjian) return 0;
+	return static_cast<std::uintmax_t>(wenjian.tellg());
+}
 
-	uint8_t result;
-	if (x % 2 == 0) result = zijie >> 4;
-	else result = zijie & 0x0F; // Пиксели в байте хранятся слева направо: левый (чётный) пиксель находится в старших четырёх битах, а правый (нечётный) — в младших четырёх битах.
+// Заголовки отображённого BMP, его палитра и пиксели внутри отображения (см. bmp_layout.h)
+struct Tuxiang {
+	Wenjiantou fileHeader;
+	Xinxitou infoHeader; // biHeight положительна: результат всегда хранится снизу вверх
+	std::span<const uint8_t> tiaoseban, shuju;
+	RowView hang; // строки несжатого изображения снизу вверх
+	bool yiyasuo; // biCompression — код RLE для этой глубины цвета
+};
 
-	return result;
+// zhenCai разрешает и несжатые 24-битные изображения (для перестройки палитры)
+bool jiexiBmp(std::span<const uint8_t> zijie, Tuxiang& tu, std::string& cuowu, bool zhenCai = false) {
+	BmpLayout buju;
+	const char* xiaoxi = nullptr;
+	if (!parseBmpLayout(zijie, buju, xiaoxi)) {
+		cuowu = xiaoxi;
+		return false;
+	}
+	if (buju.bpp == 24 && !zhenCai) {
+		cuowu = "Поддерживаются только 1-, 4- и 8-битные BMP изображения с палитрой.";
+		return false;
+	}
+	std::memcpy(&tu.fileHeader, zijie.data(), sizeof(tu.fileHeader));
+	std::memcpy(&tu.infoHeader, zijie.data() + sizeof(tu.fileHeader), sizeof(tu.infoHeader));
+	tu.infoHeader.biSize = sizeof(tu.infoHeader);
+	tu.infoHeader.biHeight = buju.height;
+	tu.tiaoseban = buju.palette;
+	tu.shuju = buju.data;
+	tu.hang = buju.rows();
+	tu.yiyasuo = buju.compressed();
+	return true;
 }
 
-std::vector<uint8_t> bianmaRLE4(const std::vector<uint8_t>& shuju, int kuandu, int gaodu) {
-	std::vector<uint8_t> bianmahou;
-	for (int y = gaodu - 1; y >= 0; y--) {
-		int x = 0;
-		while (x < kuandu) {
-			uint8_t color = getPixel(shuju, kuandu, x, y, gaodu);
-			int count = 1;
-			while (x + count < kuandu && getPixel(shuju, kuandu, x + count, y, gaodu) == color && count < 255)
-				count++;
-			bianmahou.push_back(count);
-			bianmahou.push_back((color << 4) | color);
-			x += count;
-		}
-		bianmahou.push_back(0);
-		bianmahou.push_back(0);
+// Запись заголовков и палитры tu, за ними — данные с типом сжатия yasuo
+bool xieruBmp(const std::string& outputFile, Tuxiang tu, uint32_t yasuo, const std::vector<uint8_t>& shuju,
+	std::string& cuowu) {
+	StageTimer jishi(STAGE_WRITE);
+	std::ofstream fout(outputFile.c_str(), std::ios::binary);
+	if (!fout) {
+		cuowu = "Не удалось создать выходной файл.";
+		return false;
+	}
+
+	// Обновление данных BMP-файла
+	tu.infoHeader.biCompression = yasuo;
+	tu.infoHeader.biSizeImage = shuju.size();
+	tu.fileHeader.bfOffBits = sizeof(tu.fileHeader) + sizeof(tu.infoHeader) + tu.tiaoseban.size();
+	tu.fileHeader.bfSize = tu.fileHeader.bfOffBits + shuju.size();
+	fout.write(reinterpret_cast<char*>(&tu.fileHeader), sizeof(tu.fileHeader));
+	fout.write(reinterpret_cast<char*>(&tu.infoHeader), sizeof(tu.infoHeader));
+	fout.write(reinterpret_cast<const char*>(tu.tiaoseban.data()), tu.tiaoseban.size());
+	fout.write(reinterpret_cast<const char*>(shuju.data()), shuju.size());
+	fout.close();
+	if (!fout) {
+		cuowu = "Не удалось записать выходной файл.";
+		return false;
 	}
-	bianmahou.push_back(0);
-	bianmahou.push_back(1);
-	return bianmahou;
+	stageCount(STAT_BYTES_OUT, tu.fileHeader.bfSize);
+	return true;
 }
 
-std::uintmax_t huoquwenjiandaxiao(const std::string& wenjianming) {
-	std::ifstream wenjian(wenjianming.c_str(), std::ios::binary | std::ios::ate);
-	if (!wenjian) return 0;
-	return static_cast<std::uintmax_t>(wenjian.tellg());
+// Запись индекса строк suoyin рядом с результатом (выход.bmp.idx) для чтения фрагментов
+bool baocunHangSuoyin(const std::string& outputFile, const RLERowIndex& suoyin, std::string& cuowu) {
+	std::vector<uint8_t> zijie;
+	writeRLERowIndex(suoyin, zijie);
+	std::ofstream fout((outputFile + ".idx").c_str(), std::ios::binary);
+	fout.write(reinterpret_cast<const char*>(zijie.data()), zijie.size());
+	fout.close();
+	if (!fout) {
+		cuowu = "Не удалось записать индекс строк.";
+		return false;
+	}
+	stageCount(STAT_BYTES_OUT, zijie.size());
+	return true;
 }
 
-int main() {
-	std::string inputFile, outputFile;
-	std::cout << "Введите имя выходного BMP файла: ";
-	std::cin >> inputFile;
+// Индекс строк сжатого результата, каждая buchang-я строка
+bool xieruHangSuoyin(const std::string& outputFile, int weishu, const std::vector<uint8_t>& bianmaResult, int gaodu,
+	int buchang, std::string& cuowu) {
+	StageTimer jishi(STAGE_INDEX);
+	RLERowIndex suoyin;
+	if (!makeRLERowIndex(weishu, bianmaResult, gaodu, buchang, suoyin)) {
+		cuowu = "Не удалось построить индекс строк.";
+		return false;
+	}
+	return baocunHangSuoyin(outputFile, suoyin, cuowu);
+}
 
-	std::ifstream fin(inputFile.c_str(), std::ios::binary); // Открыть файл в двоичном режиме
-	if (!fin) {
-		std::cerr << "Не удалось открыть входной файл.\n";
+// Шаг индекса строк для результата -u: как у старый_rle.bmp.idx, если тот читается, иначе как у
+// оставшегося с прошлого раза выход.bmp.idx (1, если тот не читается), который описывал бы прежний
+// поток; 0 — индекс не нужен
+int gengxinSuoyinBuchang(const std::string& jiuRle, size_t liuChangdu, const std::string& outputFile) {
+	RLERowIndex suoyin;
+	MappedInput wenjian;
+	if (wenjian.open(jiuRle + ".idx") && readRLERowIndex(wenjian.bytes(), liuChangdu, suoyin)) return suoyin.step;
+	if (!wenjian.open(outputFile + ".idx")) return 0;
+	return readRLERowIndex(wenjian.bytes(), SIZE_MAX, suoyin) ? suoyin.step : 1;
+}
+
+// Сжатие несжатого BMP с палитрой или распаковка RLE обратно в BI_RGB. При suoyinBuchang > 0 рядом
+// со сжатым результатом пишется индекс строк. youhuaTiaoseban перед сжатием перестраивает палитру
+// (reducePalette из palette.h) и разрешает 24-битный вход не больше чем с 256 цветами. bianmaResult —
+// буфер вызывающего, его ёмкость сохраняется; при ошибке текст сообщения пишется в cuowu.
+bool chuliWenjian(const std::string& inputFile, const std::string& outputFile, ThreadPool* chi,
+	std::vector<uint8_t>& bianmaResult, bool& jieya, std::string& cuowu, int suoyinBuchang = 0,
+	bool youhuaTiaoseban = false) {
+	if (sameFile(inputFile, outputFile)) {
+		cuowu = "Выходной файл совпадает с входным.";
+		return false;
+	}
+	MappedInput wenjian; // Файл отображается в память, пиксели читаются прямо оттуда без копирования
+	bool dakai;
+	{
+		StageTimer jishi(STAGE_READ);
+		dakai = wenjian.open(inputFile);
+	}
+	if (!dakai) {
+		cuowu = "Не удалось открыть входной файл.";
+		return false;
+	}
+	stageCount(STAT_BYTES_IN, wenjian.bytes().size());
+	Tuxiang tu;
+	bool jiexi;
+	{
+		StageTimer jishi(STAGE_PARSE);
+		jiexi = jiexiBmp(wenjian.bytes(), tu, cuowu, youhuaTiaoseban);
+	}
+	if (!jiexi) return false;
+	int weishu = tu.infoHeader.biBitCount, kuandu = tu.infoHeader.biWidth, gaodu = tu.infoHeader.biHeight;
+	jieya = tu.yiyasuo; // файл уже сжат, распаковываем обратно
+	stageCount(STAT_SYMBOLS, uint64_t(kuandu) * uint64_t(gaodu));
+	IndexedImage xinTu;
+	if (!jieya && youhuaTiaoseban) {
+		StageTimer jishi(STAGE_PALETTE);
+		if (!reducePalette(weishu, tu.tiaoseban, tu.hang, kuandu, gaodu, xinTu)) {
+			cuowu = "В 24-битном изображении больше 256 цветов.";
+			return false;
+		}
+		weishu = xinTu.bpp;
+		tu.hang = RowView(xinTu.pixels, (size_t(kuandu) * weishu + 7) / 8);
+		tu.tiaoseban = xinTu.palette;
+		tu.infoHeader.biBitCount = uint16_t(weishu);
+		tu.infoHeader.biClrUsed = tu.infoHeader.biClrImportant = uint32_t(xinTu.palette.size() / 4);
+	}
+
+	if (jieya) {
+		size_t buchang = (size_t(kuandu) * weishu + 31) / 32 * 4; // строки несжатого BMP выровнены до 4 байт
+		StageTimer jishi(STAGE_DECODE);
+		if (activeStageStats()) stageCount(STAT_RUNS, countRLERuns(weishu, tu.shuju));
+		if (!decodeRLE(weishu, tu.shuju, kuandu, gaodu, buchang, bianmaResult)) {
+			cuowu = "Файл повреждён: ошибка в данных RLE.";
+			return false;
+		}
+	}
+	else {
+		StageTimer jishi(STAGE_ENCODE);
+		bianmaRLE(weishu, tu.hang, kuandu, gaodu, chi, bianmaResult);
+		if (activeStageStats()) stageCount(STAT_RUNS, countRLERuns(weishu, bianmaResult));
+	}
+	if (!xieruBmp(outputFile, tu, jieya ? BI_RGB : rleCompression(weishu), bianmaResult, cuowu)) return false;
+	return jieya || suoyinBuchang <= 0 || xieruHangSuoyin(outputFile, weishu, bianmaResult, gaodu, suoyinBuchang, cuowu);
+}
+
+// Инкрементальное обновление: bmpyasuo -u старый.bmp старый_rle.bmp новый.bmp выход.bmp, где
+// старый_rle.bmp — результат сжатия старого.bmp. Заново кодируются только строки, которые в новом
+// изображении отличаются от старого, остальные копируются из старого потока (updateRLE в rle.h).
+// Скопированные и перекодированные строки должны значить одни и те же цвета, поэтому палитры всех
+// трёх файлов обязаны совпадать: результат пакетного режима с -p годится, только если перестройка
+// палитру не изменила.
+// Выход не должен совпадать со входами: они отображены до конца записи. Если у старый_rle.bmp или
+// выход.bmp есть индекс строк, выход.bmp.idx переписывается по началам строк из updateRLE
+int zengliangGengxin(char* argv[]) {
+	const char* mingzi[3] = { argv[0], argv[1], argv[2] };
+	MappedInput wenjian[3];
+	Tuxiang tu[3];
+	std::string cuowu;
+	for (int k = 0; k < 3; ++k) {
+		if (sameFile(mingzi[k], argv[3])) {
+			std::cerr << argv[3] << ": выходной файл совпадает с входным " << mingzi[k] << ".\n";
+			return 1;
+		}
+	}
+	for (int k = 0; k < 3; ++k) {
+		if (!wenjian[k].open(mingzi[k])) {
+			std::cerr << mingzi[k] << ": Не удалось открыть входной файл.\n";
+			return 1;
+		}
+		if (!jiexiBmp(wenjian[k].bytes(), tu[k], cuowu)) {
+			std::cerr << mingzi[k] << ": " << cuowu << "\n";
+			return 1;
+		}
+	}
+	const Xinxitou& jiu = tu[0].infoHeader;
+	for (int k : { 1, 2 }) {
+		const Xinxitou& xin = tu[k].infoHeader;
+		if (xin.biWidth != jiu.biWidth || xin.biHeight != jiu.biHeight || xin.biBitCount != jiu.biBitCount) {
+			std::cerr << mingzi[k] << ": размеры или глубина цвета не совпадают с " << mingzi[0] << "\n";
+			return 1;
+		}
+		// скопированные строки остаются в индексах старый_rle.bmp, а выход получает палитру нового
+		if (!samePalette(tu[k].tiaoseban, tu[0].tiaoseban)) {
+			std::cerr << mingzi[k] << ": палитра не совпадает с " << mingzi[0]
+				<< " (сжатые с -p файлы годятся, только если палитра не изменилась)\n";
+			return 1;
+		}
+	}
+	if (tu[0].yiyasuo || !tu[1].yiyasuo || tu[2].yiyasuo) {
+		std::cerr << "Ожидаются несжатые старый и новый файлы и сжатый старый.\n";
 		return 1;
 	}
 
-	Wenjiantou fileHeader;
-	fin.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
-	if (fileHeader.bfType != 0x4D42) {
-		std::cerr << "Это не корректный файл.\n";
+	int weishu = jiu.biBitCount, kuandu = jiu.biWidth, gaodu = jiu.biHeight;
+	std::vector<size_t> hangweizhi;
+	std::vector<uint8_t> bianmaResult;
+	long gaibian = updateRLE(weishu, tu[0].hang, tu[2].hang, kuandu, gaodu, tu[1].shuju, hangweizhi, bianmaResult);
+	if (gaibian < 0) {
+		std::cerr << mingzi[1] << ": RLE-поток не разбивается на строки изображения.\n";
+		return 1;
+	}
+	if (!xieruBmp(argv[3], tu[2], rleCompression(weishu), bianmaResult, cuowu)) {
+		std::cerr << cuowu << "\n";
+		return 1;
+	}
+	RLERowIndex suoyin;
+	int buchang = gengxinSuoyinBuchang(mingzi[1], tu[1].shuju.size(), argv[3]);
+	if (buchang > 0 && !(sampleRLERowIndex(hangweizhi, buchang, suoyin) && baocunHangSuoyin(argv[3], suoyin, cuowu))) {
+		std::cerr << (cuowu.empty() ? "Не удалось построить индекс строк." : cuowu) << "\n";
 		return 1;
 	}
+	std::cout << "Перекодировано строк: " << gaibian << " из " << gaodu << ", создан файл: " << argv[3] << "\n";
+	return 0;
+}
 
-	Xinxitou infoHeader;
-	fin.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-	if (infoHeader.biBitCount != 4) {
-		std::cerr << "Поддерживаются только 4-битные (16 цветов) BMP изображения.\n";
+// Фрагмент: bmpyasuo -t X Y Ш В вход.bmp выход.bmp вырезает из сжатого вход.bmp прямоугольник Ш x В
+// с левым верхним пикселем (X, Y) (от левого верхнего угла) в несжатый выход.bmp. Декодируются
+// только строки фрагмента, параллельно; их начала берутся из вход.bmp.idx (пакетный режим с -i),
+// а без него — из одного прохода по заголовкам команд
+int qiepian(char* argv[]) {
+	int juxing[4];
+	for (int k = 0; k < 4; ++k) {
+		char* end = nullptr;
+		long v = std::strtol(argv[k], &end, 10);
+		if (*end != 0 || v < 0 || v > 0x7FFFFFFF) {
+			std::cerr << "Неверная координата: " << argv[k] << "\n";
+			return 2;
+		}
+		juxing[k] = int(v);
+	}
+	std::string inputFile = argv[4], outputFile = argv[5], cuowu;
+	if (sameFile(inputFile, outputFile)) {
+		std::cerr << "Выходной файл совпадает с входным.\n";
+		return 1;
+	}
+	MappedInput wenjian;
+	Tuxiang tu;
+	if (!wenjian.open(inputFile)) {
+		std::cerr << "Не удалось открыть входной файл.\n";
+		return 1;
+	}
+	if (!jiexiBmp(wenjian.bytes(), tu, cuowu)) {
+		std::cerr << cuowu << "\n";
+		return 1;
+	}
+	int weishu = tu.infoHeader.biBitCount, kuandu = tu.infoHeader.biWidth, gaodu = tu.infoHeader.biHeight;
+	int x = juxing[0], y = juxing[1], w = juxing[2], h = juxing[3];
+	if (!tu.yiyasuo || w == 0 || h == 0 || x > kuandu - w || y > gaodu - h) {
+		std::cerr << "Фрагмент должен лежать внутри сжатого изображения.\n";
 		return 1;
 	}
 
-	int tiaosebandaxiao = 16 * 4;
-	std::vector<uint8_t> tiaoseban(tiaosebandaxiao);
-	fin.read(reinterpret_cast<char*>(&tiaoseban[0]), tiaosebandaxiao);
+	RLERowIndex suoyin;
+	MappedInput suoyinWenjian;
+	if (!(suoyinWenjian.open(inputFile + ".idx") && readRLERowIndex(suoyinWenjian.bytes(), tu.shuju.size(), suoyin) &&
+		suoyin.rows == gaodu) && !makeRLERowIndex(weishu, tu.shuju, gaodu, 16, suoyin)) {
+		std::cerr << "Файл повреждён: RLE-поток не разбивается на строки.\n";
+		return 1;
+	}
+	ThreadPool chi(std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<uint8_t> pian;
+	size_t buchang = (size_t(w) * weishu + 31) / 32 * 4; // строки несжатого BMP выровнены до 4 байт
+	// строки хранятся снизу вверх
+	if (!decodeRLERect(weishu, tu.shuju, suoyin, kuandu, x, gaodu - y - h, w, h, buchang, &chi, pian)) {
+		std::cerr << "Файл повреждён: ошибка в данных RLE.\n";
+		return 1;
+	}
+	tu.infoHeader.biWidth = w;
+	tu.infoHeader.biHeight = h;
+	if (!xieruBmp(outputFile, tu, BI_RGB, pian, cuowu)) {
+		std::cerr << cuowu << "\n";
+		return 1;
+	}
+	std::cout << "Фрагмент " << w << "x" << h << " записан в " << outputFile << "\n";
+	return 0;
+}
 
-	// shujudaxiao = wenjainzongdaixao - wenjaintouhetiaosebandaixao
-	int shujudaxiao = fileHeader.bfSize - fileHeader.bfOffBits;
-	std::vector<uint8_t> tupianshuju(shujudaxiao);
-	fin.read(reinterpret_cast<char*>(&tupianshuju[0]), shujudaxiao);
-	fin.close();
+// Пакетный режим: bmpyasuo [-j N] [-i[шаг]] [-p] [-m] -o каталог файлы, каталоги, шаблоны, @список.
+// Результаты лежат в каталоге под теми же относительными именами; файл кодируется в одном потоке,
+// буфер остаётся у потока. -i пишет рядом с каждым сжатым результатом индекс каждой шаг-й строки
+// (по умолчанию всех), -p перед сжатием перестраивает палитру, -m печатает в stderr строку
+// статистики этапов на каждый файл (stage_stats.h). Что -p перенумеровал цвета, в файле не
+// отмечается: основой для -u такой результат служит, только если палитра не изменилась
+// (zengliangGengxin сверяет палитры)
+int piliangchuli(int argc, char* argv[]) {
+	BatchOptions canshu;
+	std::string cuowu;
+	int suoyinBuchang = 0;
+	bool youhuaTiaoseban = false, tongji = false;
+	bool canshuZhengque = parseBatchArgs(argc, argv, canshu, cuowu);
+	for (const std::string& biaozhi : canshu.flags) {
+		if (biaozhi == "-p") {
+			youhuaTiaoseban = true;
+			continue;
+		}
+		if (biaozhi == "-m") {
+			tongji = true;
+			continue;
+		}
+		char* end = nullptr;
+		long buchang = biaozhi.size() == 2 ? 1 : std::strtol(biaozhi.c_str() + 2, &end, 10);
+		if (biaozhi.compare(0, 2, "-i") != 0 || (end && *end != 0) || buchang < 1 || buchang > 65536)
+			canshuZhengque = false;
+		else suoyinBuchang = int(buchang);
+	}
+	if (!canshuZhengque || canshu.inputs.empty() || canshu.outDir.empty()) {
+		if (!cuowu.empty()) std::cerr << cuowu << "\n";
+		std::cerr << "Использование: bmpyasuo [-j N] [-i[шаг]] [-p] [-m] -o каталог файлы, каталоги, шаблоны, @список\n"
+			<< "               (-p перестраивает палитру; такие результаты не годятся основой для -u,\n"
+			<< "                если палитра изменилась)\n";
+		return 2;
+	}
+	return runBatch(canshu, ".bmp", [&](const BatchFile& wenjian, BatchReport& baogao) {
+		thread_local std::vector<uint8_t> bianmaResult;
+		std::string outputFile = batchOutputBase(wenjian, canshu.outDir);
+		bool jieya = false;
+		std::string xiaoxi;
+		StageStats tongjiShuju;
+		StageScope fanwei(tongji ? &tongjiShuju : nullptr);
+		auto kaishi = std::chrono::steady_clock::now();
+		bool chenggong = chuliWenjian(wenjian.path, outputFile, nullptr, bianmaResult, jieya, xiaoxi, suoyinBuchang,
+			youhuaTiaoseban);
+		if (tongji) {
+			double miao = std::chrono::duration<double>(std::chrono::steady_clock::now() - kaishi).count();
+			printStageStats(std::cerr, "bmpyasuo", jieya ? "decompress" : "compress", wenjian.path, chenggong, miao,
+				tongjiShuju);
+		}
+		if (!chenggong) return baogao.fail(wenjian.path, xiaoxi);
+		baogao.done(wenjian.size, huoquwenjiandaxiao(outputFile));
+	});
+}
 
-	std::vector<uint8_t> bianmaResult = bianmaRLE4(tupianshuju, infoHeader.biWidth, infoHeader.biHeight);
+int main(int argc, char* argv[]) {
+	if (argc == 6 && std::string(argv[1]) == "-u") return zengliangGengxin(argv + 2);
+	if (argc == 8 && std::string(argv[1]) == "-t") return qiepian(argv + 2);
+	if (argc > 1) return piliangchuli(argc, argv);
 
+	std::string inputFile, outputFile;
+	std::cout << "Введите имя выходного BMP файла: ";
+	std::cin >> inputFile;
 	std::cout << "Введите имя выходного BMP файл: ";
 	std::cin >> outputFile;
 
-	std::ofstream fout(outputFile.c_str(), std::ios::binary);
-	if (!fout) {
-		std::cerr << "Не удалось создать выходной файл.\n";
+	ThreadPool chi(std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<uint8_t> bianmaResult;
+	bool jieya = false;
+	std::string cuowu;
+	if (!chuliWenjian(inputFile, outputFile, &chi, bianmaResult, jieya, cuowu)) {
+		std::cerr << cuowu << "\n";
 		return 1;
 	}
-	// Создать бинарный выходной файл и проверить, успешно ли он открыт.
-
-
-	// Обновление данных BMP-файла
-	infoHeader.biCompression = 2;
-	infoHeader.biSizeImage = bianmaResult.size();
-	fileHeader.bfSize = fileHeader.bfOffBits + bianmaResult.size();
-	fout.write(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
-	fout.write(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-	fout.write(reinterpret_cast<char*>(&tiaoseban[0]), tiaosebandaxiao);
-	fout.write(reinterpret_cast<char*>(&bianmaResult[0]), bianmaResult.size());
-	fout.close();
 
+	if (jieya) {
+		std::cout << "Распаковка завершена! Создан файл: " << outputFile << "\n";
+		return 0;
+	}
 	std::cout << "Сжатие завершено! Создан файл: " << outputFile << "\n\n";
 
 	std::uintmax_t yuanlaidesize = huoquwenjiandaxiao(inputFile);
@@ -0,0 +1,146 @@
+// Разделяемая библиотека кодеков (интерфейс — codec_api.h). Кодеки берутся из huffandshf.cpp и
+// rle.h целиком, как в codec_bench.cpp; глобальный operator new библиотека не подменяет.
+#define HUFFANDSHF_NO_MAIN
+#define STAGE_STATS_NO_ALLOCATION_HOOK
+#define CODEC_API_BUILD
+#include "huffandshf.cpp"
+#include "rle.h"
+#include "codec_api.h"
+
+static const Codec& codecFor(CodecAlgorithm algorithm) {
+    return algorithm == CODEC_TANS ? TANS_CODEC : algorithm == CODEC_SHANNON_FANO ? SHANNON_FANO_CODEC : HUFFMAN_CODEC;
+}
+
+// Алгоритм архива по сигнатуре; формат тела у всех трёх общий.
+static const Codec* codecForArchive(span<const uint8_t> archive) {
+    if (archive.size() <= 4) return nullptr;
+    for (const Codec* codec : { &HUFFMAN_CODEC, &SHANNON_FANO_CODEC, &TANS_CODEC })
+        if (memcmp(archive.data(), codec->magic.data(), 4) == 0) return codec;
+    return nullptr;
+}
+
+bool codecTrainDictionary(CodecAlgorithm algorithm, span<const span<const uint8_t>> samples, span<uint8_t> out,
+                          size_t& written) {
+    written = 0;
+    if (algorithm == CODEC_TANS) return false;
+    size_t counts[256] = {}, freq[256];
+    for (span<const uint8_t> sample : samples) {
+        byteHistogram(sample.data(), sample.size(), freq);
+        for (int s = 0; s < 256; ++s) counts[s] += freq[s];
+    }
+    Dictionary dictionary;
+    string bytes;
+    if (!buildDictionary(counts, codecFor(algorithm).build, dictionary)) return false;
+    writeDictionary(dictionary, bytes);
+    if (bytes.size() > out.size()) return false;
+    memcpy(out.data(), bytes.data(), bytes.size());
+    written = bytes.size();
+    return true;
+}
+
+size_t codecCompressBound(size_t n) {
+    if (n > (SIZE_MAX >> 4)) return SIZE_MAX;
+    return size_t(archiveBound(n));
+}
+
+bool codecDecompressedSize(span<const uint8_t> archive, size_t& size) {
+    uint64_t rawLen;
+    if (!codecForArchive(archive) || !archiveRawLength(archive, rawLen) || rawLen > SIZE_MAX) return false;
+    size = size_t(rawLen);
+    return true;
+}
+
+struct CodecContext::State {
+    const Codec& codec;
+    int lzLevel;
+    ThreadPool pool;
+    string archive;    // архив из одного потока
+    BlockIndex index;  // разобранный индекс блочного архива
+    Dictionary dictionary;
+    bool hasDictionary = false;
+};
+
+CodecContext::CodecContext(CodecAlgorithm algorithm, int lzLevel, unsigned threads)
+    : state(new State{ codecFor(algorithm), algorithm == CODEC_TANS ? 0 : max(0, min(lzLevel, LZ_MAX_LEVEL)),
+                       ThreadPool(max(1u, threads)), {}, {}, {}, false }) {}
+
+CodecContext::~CodecContext() = default;
+
+bool CodecContext::setDictionary(span<const uint8_t> dictionary) {
+    state->hasDictionary = false;
+    if (dictionary.empty()) return true;
+    if (state->codec.build == TANS_CODER || !readDictionary(dictionary, state->dictionary)) return false;
+    state->hasDictionary = true;
+    return true;
+}
+
+bool CodecContext::compress(span<const uint8_t> in, span<uint8_t> out, size_t& written) {
+    BlockPolicy policy = chooseBlockPolicy(in.size());
+    policy.threads = state->pool.size();
+    policy.lzLevel = state->lzLevel;
+    policy.dictionary = state->hasDictionary ? &state->dictionary : nullptr;
+    return compressInto(in, out, written, state->codec.magic, state->codec.build, policy, state->pool, state->archive);
+}
+
+bool CodecContext::decompress(span<const uint8_t> archive, span<uint8_t> out, size_t& written) {
+    written = 0;
+    const Codec* codec = codecForArchive(archive);
+    return codec && decompressInto(archive, codec->magic, out, written, state->pool, state->index,
+                                   state->hasDictionary ? &state->dictionary : nullptr);
+}
+
+bool codecCompress(CodecAlgorithm algorithm, span<const uint8_t> in, span<uint8_t> out, size_t& written, int lzLevel) {
+    CodecContext context(algorithm, lzLevel);
+    return context.compress(in, out, written);
+}
+
+bool codecDecompress(span<const uint8_t> archive, span<uint8_t> out, size_t& written) {
+    CodecContext context;
+    return context.decompress(archive, out, written);
+}
+
+// Каждый пиксель стоит не больше двух байт: пара кодирует хотя бы один, а литерал абсолютного
+// режима — от трёх пикселей и тратит на заголовок и выравнивание не больше трёх байт. К строке
+// добавляется конец строки, к изображению — конец изображения.
+size_t rleCompressBound(int bpp, int width, int height) {
+    if ((bpp != 1 && bpp != 4 && bpp != 8) || width <= 0 || height <= 0) return 0;
+    return (2 * size_t(width) + 2) * size_t(height) + 2;
+}
+
+// Размеры изображения и буфера строк согласованы: строка вмещает width пикселей, буфер — height строк.
+static bool validRleImage(int bpp, int width, int height, size_t stride, size_t bufferSize) {
+    if ((bpp != 1 && bpp != 4 && bpp != 8) || width <= 0 || height <= 0) return false;
+    size_t rowBytes = (size_t(width) * size_t(bpp) + 7) / 8;
+    if (stride < rowBytes || stride > (SIZE_MAX - rowBytes) / size_t(height)) return false;
+    return bufferSize >= stride * size_t(height - 1) + rowBytes;
+}
+
+struct RleContext::State {
+    ThreadPool pool;
+    vector<uint8_t> buffer;  // поток или пиксели до копирования в буфер вызывающего
+};
+
+RleContext::RleContext(unsigned threads) : state(new State{ ThreadPool(max(1u, threads)), {} }) {}
+
+RleContext::~RleContext() = default;
+
+bool RleContext::compress(int bpp, span<const uint8_t> pixels, size_t stride, int width, int height,
+                          span<uint8_t> out, size_t& written) {
+    written = 0;
+    if (!validRleImage(bpp, width, height, stride, pixels.size())) return false;
+    RowView rows(pixels, stride);
+    if (state->pool.size() > 1) state->buffer = encodeRLEParallel(bpp, rows, width, height, state->pool);
+    else encodeRLE(bpp, rows, width, height, state->buffer);
+    if (state->buffer.size() > out.size()) return false;
+    memcpy(out.data(), state->buffer.data(), state->buffer.size());
+    written = state->buffer.size();
+    return true;
+}
+
+bool RleContext::decompress(int bpp, span<const uint8_t> in, int width, int height, size_t stride,
+                            span<uint8_t> out) {
+    if (!validRleImage(bpp, width, height, stride, out.size()) || out.size() < stride * size_t(height)) return false;
+    if (!decodeRLE(bpp, in, width, height, stride, state->buffer)) return false;
+    memcpy(out.data(), state->buffer.data(), state->buffer.size());
+    return true;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+
+// Библиотечный интерфейс кодеков: сжатие и распаковка из буфера в буфер, без файлов и потоков
+// ввода-вывода. Архивы те же, что пишет и читает huffandshf (HUF2/SFA2/ANS2), потоки RLE — те же,
+// что в BMP-файлах BMPyasuo/bmpyasuo. Разделяемая библиотека собирается из codec_api.cpp:
+//   g++ -std=c++20 -O2 -fPIC -fvisibility=hidden -shared codec_api.cpp -o libcodec.so -pthread
+// Наружу видны только имена с CODEC_API; внутренности кодеков остаются скрытыми и не спорят с
+// одноимёнными функциями других библиотек (например, crc32 из zlib).
+//
+// Контекст держит пул потоков, таблицы и рабочие буферы между вызовами: для потока запросов
+// заводится один контекст на рабочий поток. Один контекст нельзя использовать из двух потоков
+// одновременно, разные — можно.
+#ifdef _WIN32
+#ifdef CODEC_API_BUILD
+#define CODEC_API __declspec(dllexport)
+#else
+#define CODEC_API __declspec(dllimport)
+#endif
+#else
+#define CODEC_API __attribute__((visibility("default")))
+#endif
+
+enum CodecAlgorithm { CODEC_HUFFMAN, CODEC_SHANNON_FANO, CODEC_TANS };
+
+// Наибольший размер архива из n байт входа для любого алгоритма и уровня.
+CODEC_API size_t codecCompressBound(size_t n);
+
+// Статические словари для небольших сообщений, как у huffandshf -t: файл словаря не длиннее
+// CODEC_DICTIONARY_MAX_SIZE байт.
+const size_t CODEC_DICTIONARY_MAX_SIZE = 4 + 4 + 289;
+
+// Словарь по образцам для CODEC_HUFFMAN или CODEC_SHANNON_FANO; в out — файл словаря, в written —
+// его размер.
+CODEC_API bool codecTrainDictionary(CodecAlgorithm algorithm, std::span<const std::span<const uint8_t>> samples,
+                                    std::span<uint8_t> out, size_t& written);
+
+// Длина распакованных данных по заголовку архива, без декодирования; false, если это не архив
+// HUF2/SFA2/ANS2 или заголовок повреждён.
+CODEC_API bool codecDecompressedSize(std::span<const uint8_t> archive, size_t& size);
+
+class CODEC_API CodecContext {
+public:
+    // lzLevel — уровень LZ77 перед префиксным кодом (0–9, у tANS не используется); threads —
+    // потоков на блоки одного вызова, 1 — всё в вызывающем потоке.
+    explicit CodecContext(CodecAlgorithm algorithm = CODEC_HUFFMAN, int lzLevel = 0, unsigned threads = 1);
+    ~CodecContext();
+    CodecContext(const CodecContext&) = delete;
+    CodecContext& operator=(const CodecContext&) = delete;
+
+    // Словарь (файл от codecTrainDictionary или huffandshf -t) для следующих вызовов: архивы ссылаются
+    // на него вместо таблицы кода и читаются только с ним же. Пустой — без словаря. false, если файл
+    // повреждён или алгоритм контекста — tANS.
+    bool setDictionary(std::span<const uint8_t> dictionary);
+
+    // Архив in в out, в written — его размер. false, если out мал: буфера codecCompressBound(in.size())
+    // хватает всегда.
+    bool compress(std::span<const uint8_t> in, std::span<uint8_t> out, size_t& written);
+
+    // Распаковка архива любого из трёх алгоритмов в out, в written — длина данных. false, если
+    // архив повреждён или out меньше codecDecompressedSize.
+    bool decompress(std::span<const uint8_t> archive, std::span<uint8_t> out, size_t& written);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+// Разовые вызовы без своего контекста: в каждом вызове заводятся и освобождаются рабочие буферы.
+CODEC_API bool codecCompress(CodecAlgorithm algorithm, std::span<const uint8_t> in, std::span<uint8_t> out,
+                             size_t& written, int lzLevel = 0);
+CODEC_API bool codecDecompress(std::span<const uint8_t> archive, std::span<uint8_t> out, size_t& written);
+
+// Наибольший размер потока RLE изображения width×height при bpp 1, 4 или 8.
+CODEC_API size_t rleCompressBound(int bpp, int width, int height);
+
+// Потоки BI_RLE8/BI_RLE4/'RLE1' (rle.h) над несжатыми строками с шагом stride в порядке потока —
+// снизу вверх, как в BMP. Строки кодируются параллельно, если контекст создан с threads > 1.
+class CODEC_API RleContext {
+public:
+    explicit RleContext(unsigned threads = 1);
+    ~RleContext();
+    RleContext(const RleContext&) = delete;
+    RleContext& operator=(const RleContext&) = delete;
+
+    // pixels — height строк по stride байт (у последней достаточно байт на пиксели); в written —
+    // размер потока. false при неверных размерах или если out мал (см. rleCompressBound).
+    bool compress(int bpp, std::span<const uint8_t> pixels, size_t stride, int width, int height,
+                  std::span<uint8_t> out, size_t& written);
+
+    // Распаковка в out: stride·height байт, строки с шагом stride. false, если поток повреждён,
+    // размеры неверны или out меньше stride·height.
+    bool decompress(int bpp, std::span<const uint8_t> in, int width, int height, size_t stride,
+                    std::span<uint8_t> out);
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
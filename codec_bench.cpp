@@ -0,0 +1,456 @@
+#define HUFFANDSHF_NO_MAIN
+#include "huffandshf.cpp"
+#include <climits>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <set>
+#include "rle.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Замер всех кодеков на сгенерированном корпусе: текст, журналы, равномерно случайные байты,
+// перекошенное распределение и синтетические 4-битные изображения. Для каждой пары «корпус, кодек»
+// выводятся скорость сжатия и распаковки в МБ/с и нс/байт (лучший из --rounds проходов), размер и
+// степень сжатия и пиковый RSS за время пары; каждый результат распаковывается и сверяется со входом.
+// Результаты идут в stdout и по желанию в JSON/CSV. С --baseline прогон сравнивается с CSV, сохранённым
+// раньше через --save-baseline (на той же машине): больший выход, падение скорости больше чем на
+// --tolerance процентов и пары, которых нет в одном из прогонов, считаются ухудшениями, код выхода — 1.
+//
+// codec_bench [--size МБ] [--rounds N] [--threads N] [--json файл] [--csv файл]
+//             [--baseline файл] [--save-baseline файл] [--tolerance проценты]
+
+struct CorpusEntry {
+    string name;
+    vector<uint8_t> data;
+    int width = 0;  // > 0: 4-битное изображение, строки по Pixels<4>::bytes(width) байт
+    int height = 0;
+};
+
+struct BenchResult {
+    string corpus, codec;
+    size_t inputBytes = 0, outputBytes = 0;
+    double encodeSeconds = 0, decodeSeconds = 0;
+    double peakRssMb = 0;
+    bool ok = true;
+
+    double ratio() const { return 100.0 * double(outputBytes) / double(inputBytes); }
+    double encodeMbps() const { return inputBytes / 1048576.0 / encodeSeconds; }
+    double decodeMbps() const { return inputBytes / 1048576.0 / decodeSeconds; }
+    double encodeNsPerByte() const { return encodeSeconds * 1e9 / double(inputBytes); }
+    double decodeNsPerByte() const { return decodeSeconds * 1e9 / double(inputBytes); }
+};
+
+// Пиковый RSS процесса. В Linux отметка сбрасывается перед каждой парой, и значение относится к ней
+// (вместе с уже загруженным корпусом); в остальных системах это пик за всё время процесса.
+void resetPeakRss() {
+#ifdef __linux__
+    ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+double peakRssMb() {
+#ifdef __linux__
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line))
+        if (line.rfind("VmHWM:", 0) == 0) return stod(line.substr(6)) / 1024.0;
+#endif
+#ifndef _WIN32
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+#else
+    return 0;
+#endif
+}
+
+// ---- корпус ----
+
+vector<uint8_t> makeText(size_t size, mt19937& rng) {
+    static const char* words[] = { "the", "of", "and", "to", "in", "a", "is", "that", "for", "it", "as", "was",
+                                   "with", "be", "by", "on", "not", "he", "this", "are", "or", "his", "from",
+                                   "at", "which", "but", "have", "an", "had", "they", "you", "were", "their",
+                                   "one", "all", "we", "can", "her", "has", "there", "been", "if", "more",
+                                   "when", "will", "would", "who", "so", "no", "compression", "symbol",
+                                   "frequency", "table", "block", "stream", "archive", "decoder", "bitmap" };
+    const size_t count = sizeof(words) / sizeof(words[0]);
+    vector<double> weights(count);
+    for (size_t i = 0; i < count; ++i) weights[i] = 1.0 / double(i + 1);
+    discrete_distribution<size_t> pick(weights.begin(), weights.end());
+    string text;
+    size_t sentence = 0;
+    while (text.size() < size) {
+        string word = words[pick(rng)];
+        if (sentence++ == 0) word[0] = char(toupper(word[0]));
+        text += word;
+        if (sentence > 6 + rng() % 12) {
+            text += rng() % 4 ? ". " : ".\n";
+            sentence = 0;
+        }
+        else text += rng() % 10 ? " " : ", ";
+    }
+    return vector<uint8_t>(text.begin(), text.begin() + size);
+}
+
+vector<uint8_t> makeLog(size_t size, mt19937& rng) {
+    static const char* levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char* events[] = { "request served", "cache miss", "block decoded", "connection closed",
+                                    "retrying upload", "checksum mismatch", "worker started" };
+    string text;
+    char line[160];
+    unsigned seconds = 0;
+    while (text.size() < size) {
+        seconds += rng() % 3;
+        snprintf(line, sizeof(line), "2024-05-%02u %02u:%02u:%02u [%s] worker=%u id=%08x %s\n", 1 + seconds / 86400 % 28,
+                 seconds / 3600 % 24, seconds / 60 % 60, seconds % 60, levels[rng() % 6], unsigned(rng() % 16),
+                 unsigned(rng()), events[rng() % 7]);
+        text += line;
+    }
+    return vector<uint8_t>(text.begin(), text.begin() + size);
+}
+
+vector<uint8_t> makeRandom(size_t size, mt19937& rng) {
+    vector<uint8_t> data(size);
+    for (uint8_t& b : data) b = uint8_t(rng());
+    return data;
+}
+
+// Геометрическое распределение: байт 0 примерно в трети случаев, каждый следующий реже.
+vector<uint8_t> makeSkewed(size_t size, mt19937& rng) {
+    geometric_distribution<int> dist(0.35);
+    vector<uint8_t> data(size);
+    for (uint8_t& b : data) b = uint8_t(min(dist(rng), 255));
+    return data;
+}
+
+// kind: 0 - длинные горизонтальные серии, 1 - серии с пятнами шума (как в rle_bench.cpp)
+CorpusEntry makeBitmap(const string& name, size_t size, int kind, mt19937& rng) {
+    using P = Pixels<4>;
+    CorpusEntry e;
+    e.name = name;
+    e.width = 2048;
+    size_t stride = P::bytes(e.width);
+    e.height = int(max<size_t>(1, size / stride));
+    e.data.resize(stride * e.height);
+    for (int r = 0; r < e.height; ++r) {
+        uint8_t color = 0;
+        int runLeft = 0;
+        for (int x = 0; x < e.width; ++x) {
+            uint8_t pixel;
+            if (kind == 1 && (x / 64 + r / 64) % 3 == 0) pixel = uint8_t(rng() & P::MASK);
+            else {
+                if (runLeft-- <= 0) {
+                    color = uint8_t(rng() & P::MASK);
+                    runLeft = 8 + int(rng() % 600);
+                }
+                pixel = color;
+            }
+            P::put(e.data.data() + size_t(r) * stride, x, pixel);
+        }
+    }
+    return e;
+}
+
+vector<CorpusEntry> makeCorpus(size_t size) {
+    mt19937 rng(20240501);
+    vector<CorpusEntry> corpus;
+    corpus.push_back({ "text", makeText(size, rng) });
+    corpus.push_back({ "log", makeLog(size, rng) });
+    corpus.push_back({ "random", makeRandom(size, rng) });
+    corpus.push_back({ "skewed", makeSkewed(size, rng) });
+    corpus.push_back(makeBitmap("bitmap4-runs", size, 0, rng));
+    corpus.push_back(makeBitmap("bitmap4-mixed", size, 1, rng));
+    return corpus;
+}
+
+// ---- кодеки ----
+
+// encode() оставляет результат в собственном буфере кодека и возвращает его размер (0 при ошибке);
+// decode() восстанавливает из этого буфера вход в restored.
+struct BenchCodec {
+    string name;
+    bool bitmapOnly;
+    function<size_t(const CorpusEntry&)> encode;
+    function<bool(const CorpusEntry&, vector<uint8_t>& restored)> decode;
+};
+
+// Распаковка архива заданным числом потоков (decodeArchiveBytes берёт все).
+bool decodeArchive(const string& archive, unsigned threads, vector<uint8_t>& restored) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(archive.data());
+    const uint8_t* end = p + archive.size();
+    if (archive.size() <= 4) return false;
+    if (!(p[4] & FLAG_BLOCKS)) {
+        thread_local string decoded;
+        if (!decodeSingle(p, end, decoded)) return false;
+        restored.assign(decoded.begin(), decoded.end());
+        return true;
+    }
+    BlockIndex idx;
+    if (!parseBlockIndex(p, end, idx)) return false;
+    restored.resize(size_t(idx.outOffsets.back()));
+    atomic<bool> ok(true);
+    ThreadPool pool(threads);
+    pool.parallelFor(idx.blocks.size(), [&](size_t b) {
+        if (!decodeIndexedBlock(idx, b, reinterpret_cast<char*>(&restored[size_t(idx.outOffsets[b])]))) ok = false;
+    });
+    return ok;
+}
+
+BenchCodec archiveCodec(const string& name, const string& magic, LengthBuilder build, int lzLevel, unsigned threads) {
+    auto archive = make_shared<string>();
+    return { name, false,
+             [=](const CorpusEntry& e) {
+                 BlockPolicy policy = chooseBlockPolicy(e.data.size());
+                 policy.threads = threads;
+                 policy.lzLevel = lzLevel;
+                 *archive = buildArchive(magic, span<const uint8_t>(e.data), build, policy);
+                 return archive->size();
+             },
+             [=](const CorpusEntry&, vector<uint8_t>& restored) { return decodeArchive(*archive, threads, restored); } };
+}
+
+BenchCodec rle4Codec() {
+    auto encoded = make_shared<vector<uint8_t>>();
+    return { "rle4", true,
+             [=](const CorpusEntry& e) {
+                 encodeRLE<4>(e.data, e.width, e.height, Pixels<4>::bytes(e.width), *encoded);
+                 return encoded->size();
+             },
+             [=](const CorpusEntry& e, vector<uint8_t>& restored) {
+                 return decodeRLE<4>(*encoded, e.width, e.height, Pixels<4>::bytes(e.width), restored);
+             } };
+}
+
+BenchResult runCase(const CorpusEntry& e, const BenchCodec& codec, int rounds) {
+    BenchResult r;
+    r.corpus = e.name;
+    r.codec = codec.name;
+    r.inputBytes = e.data.size();
+    vector<uint8_t> restored;
+    resetPeakRss();
+    r.encodeSeconds = r.decodeSeconds = 1e30;
+    for (int i = 0; i < rounds; ++i) {
+        auto t0 = chrono::steady_clock::now();
+        r.outputBytes = codec.encode(e);
+        r.encodeSeconds = min(r.encodeSeconds, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+    }
+    for (int i = 0; i < rounds; ++i) {
+        auto t0 = chrono::steady_clock::now();
+        r.ok = codec.decode(e, restored);
+        r.decodeSeconds = min(r.decodeSeconds, chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+    }
+    r.peakRssMb = peakRssMb();
+    r.ok = r.ok && r.outputBytes > 0 && restored == e.data;
+    return r;
+}
+
+// ---- отчёты ----
+
+// setw считает байты, а заголовки в UTF-8: дополняем по числу символов.
+string column(const string& text, size_t width, bool alignLeft = false) {
+    size_t chars = count_if(text.begin(), text.end(), [](char c) { return (uint8_t(c) & 0xC0) != 0x80; });
+    string pad(chars < width ? width - chars : 0, ' ');
+    return alignLeft ? text + pad : pad + text;
+}
+
+void printTable(const vector<BenchResult>& results) {
+    cout << column("корпус", 15, true) << column("кодек", 13, true) << column("вход", 11) << column("выход", 11)
+         << column("%", 9) << column("сж. МБ/с", 11) << column("нс/Б", 9) << column("расп. МБ/с", 12)
+         << column("нс/Б", 9) << column("RSS, МБ", 10) << "\n";
+    cout << fixed;
+    for (const BenchResult& r : results) {
+        cout << left << setw(15) << r.corpus << setw(13) << r.codec << right << setw(11) << r.inputBytes << setw(11)
+             << r.outputBytes << setprecision(2) << setw(9) << r.ratio() << setprecision(1) << setw(11)
+             << r.encodeMbps() << setprecision(2) << setw(9) << r.encodeNsPerByte() << setprecision(1)
+             << setw(12) << r.decodeMbps() << setprecision(2) << setw(9) << r.decodeNsPerByte() << setprecision(1) << setw(10)
+             << r.peakRssMb << (r.ok ? "" : "  ОШИБКА восстановления") << "\n";
+    }
+    cout << defaultfloat << setprecision(6);
+}
+
+const char* CSV_HEADER = "corpus,codec,input_bytes,output_bytes,ratio_percent,encode_mb_s,encode_ns_per_byte,"
+                         "decode_mb_s,decode_ns_per_byte,peak_rss_mb,ok";
+
+void writeCsv(ostream& out, const vector<BenchResult>& results) {
+    out << CSV_HEADER << "\n" << setprecision(6);
+    for (const BenchResult& r : results)
+        out << r.corpus << "," << r.codec << "," << r.inputBytes << "," << r.outputBytes << "," << r.ratio() << ","
+            << r.encodeMbps() << "," << r.encodeNsPerByte() << "," << r.decodeMbps() << "," << r.decodeNsPerByte()
+            << "," << r.peakRssMb << "," << (r.ok ? 1 : 0) << "\n";
+}
+
+void writeJson(ostream& out, const vector<BenchResult>& results) {
+    out << "[\n" << setprecision(6);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "  {\"corpus\": \"" << r.corpus << "\", \"codec\": \"" << r.codec << "\", \"input_bytes\": "
+            << r.inputBytes << ", \"output_bytes\": " << r.outputBytes << ", \"ratio_percent\": " << r.ratio()
+            << ", \"encode_mb_s\": " << r.encodeMbps() << ", \"encode_ns_per_byte\": " << r.encodeNsPerByte()
+            << ", \"decode_mb_s\": " << r.decodeMbps() << ", \"decode_ns_per_byte\": " << r.decodeNsPerByte()
+            << ", \"peak_rss_mb\": " << r.peakRssMb << ", \"ok\": " << (r.ok ? "true" : "false") << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+// Число из строки целиком в пределах [low, high]; иначе false, и value не меняется.
+bool parseNumber(const string& text, double low, double high, double& value) {
+    char* end = nullptr;
+    double v = strtod(text.c_str(), &end);
+    if (text.empty() || *end != 0 || !(v >= low && v <= high)) return false;
+    value = v;
+    return true;
+}
+
+template <class T>
+bool parseInteger(const string& text, long long low, long long high, T& value) {
+    char* end = nullptr;
+    long long v = strtoll(text.c_str(), &end, 10);
+    if (text.empty() || *end != 0 || v < low || v > high) return false;
+    value = T(v);
+    return true;
+}
+
+// Строки базовых результатов по ключу "корпус/кодек"; сравниваются только размеры и скорости.
+struct BaselineRow {
+    size_t outputBytes;
+    double encodeMbps, decodeMbps;
+};
+
+bool readBaseline(const string& path, map<string, BaselineRow>& rows) {
+    ifstream in(path);
+    string line;
+    if (!in || !getline(in, line) || line != CSV_HEADER) return false;
+    while (getline(in, line)) {
+        vector<string> f;
+        stringstream fields(line);
+        for (string v; getline(fields, v, ',');) f.push_back(v);
+        BaselineRow row;
+        if (f.size() != 11 || !parseInteger(f[3], 0, LLONG_MAX, row.outputBytes) ||
+            !parseNumber(f[5], 0, HUGE_VAL, row.encodeMbps) || !parseNumber(f[7], 0, HUGE_VAL, row.decodeMbps))
+            return false;
+        rows[f[0] + "/" + f[1]] = row;
+    }
+    return true;
+}
+
+// Ухудшения относительно базовых результатов: выход больше на 0,1% (размеры детерминированы, так что
+// это ловит изменения формата или модели), скорость сжатия или распаковки ниже больше чем на tolerance,
+// а также пары, которые есть только в одном из прогонов: иначе переименованный кодек проходил бы
+// проверку молча.
+int compareWithBaseline(const vector<BenchResult>& results, const map<string, BaselineRow>& baseline, double tolerance) {
+    int regressions = 0;
+    set<string> seen;
+    for (const BenchResult& r : results) {
+        auto it = baseline.find(r.corpus + "/" + r.codec);
+        if (it == baseline.end()) {
+            cout << r.corpus << "/" << r.codec << ": нет в базовых результатах\n";
+            regressions++;
+            continue;
+        }
+        seen.insert(it->first);
+        const BaselineRow& b = it->second;
+        string key = r.corpus + "/" + r.codec + ": ";
+        if (double(r.outputBytes) > double(b.outputBytes) * 1.001) {
+            cout << key << "размер " << b.outputBytes << " -> " << r.outputBytes << " байт\n";
+            regressions++;
+        }
+        if (r.encodeMbps() < b.encodeMbps * (1 - tolerance)) {
+            cout << key << "сжатие " << b.encodeMbps << " -> " << r.encodeMbps() << " МБ/с\n";
+            regressions++;
+        }
+        if (r.decodeMbps() < b.decodeMbps * (1 - tolerance)) {
+            cout << key << "распаковка " << b.decodeMbps << " -> " << r.decodeMbps() << " МБ/с\n";
+            regressions++;
+        }
+    }
+    for (const auto& [key, row] : baseline) {
+        if (seen.count(key)) continue;
+        cout << key << ": нет в этом прогоне\n";
+        regressions++;
+    }
+    return regressions;
+}
+
+int usage() {
+    cerr << "Использование: codec_bench [--size МБ] [--rounds N] [--threads N] [--json файл] [--csv файл]\n"
+         << "                   [--baseline файл] [--save-baseline файл] [--tolerance проценты]" << endl;
+    return 2;
+}
+
+int main(int argc, char* argv[]) {
+    size_t sizeMb = 4;
+    int rounds = 5;
+    unsigned threads = 1;
+    double tolerancePercent = 10;
+    string jsonPath, csvPath, baselinePath, saveBaselinePath;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 >= argc) {
+            cerr << "Неизвестный параметр или нет значения: " << arg << endl;
+            return usage();
+        }
+        string value = argv[++i];
+        bool ok = true;
+        if (arg == "--size") ok = parseInteger(value, 1, 1 << 20, sizeMb);
+        else if (arg == "--rounds") ok = parseInteger(value, 1, 1000000, rounds);
+        else if (arg == "--threads") ok = parseInteger(value, 1, 4096, threads);
+        else if (arg == "--tolerance") ok = parseNumber(value, 0, 100, tolerancePercent);
+        else if (arg == "--json") jsonPath = value;
+        else if (arg == "--csv") csvPath = value;
+        else if (arg == "--baseline") baselinePath = value;
+        else if (arg == "--save-baseline") saveBaselinePath = value;
+        else {
+            cerr << "Неизвестный параметр: " << arg << endl;
+            return usage();
+        }
+        if (!ok) {
+            cerr << "Неверное значение " << arg << ": " << value << endl;
+            return usage();
+        }
+    }
+
+    vector<CorpusEntry> corpus = makeCorpus(sizeMb << 20);
+    vector<BenchCodec> codecs = {
+        archiveCodec("huffman", "HUF2", huffmanLengths, 0, threads),
+        archiveCodec("shannon-fano", "SFA2", shannonFanoLengths, 0, threads),
+        archiveCodec("tans", "ANS2", TANS_CODER, 0, threads),
+        archiveCodec("lz1-huffman", "HUF2", huffmanLengths, 1, threads),
+        archiveCodec("lz6-huffman", "HUF2", huffmanLengths, 6, threads),
+        rle4Codec(),
+    };
+    vector<BenchResult> results;
+    for (const CorpusEntry& e : corpus)
+        for (const BenchCodec& c : codecs)
+            if (!c.bitmapOnly || e.width > 0) results.push_back(runCase(e, c, rounds));
+    printTable(results);
+
+    if (!csvPath.empty()) {
+        ofstream out(csvPath);
+        writeCsv(out, results);
+    }
+    if (!jsonPath.empty()) {
+        ofstream out(jsonPath);
+        writeJson(out, results);
+    }
+    if (!saveBaselinePath.empty()) {
+        ofstream out(saveBaselinePath);
+        writeCsv(out, results);
+    }
+
+    bool failed = any_of(results.begin(), results.end(), [](const BenchResult& r) { return !r.ok; });
+    if (!baselinePath.empty()) {
+        map<string, BaselineRow> baseline;
+        if (!readBaseline(baselinePath, baseline)) {
+            cerr << "Не удалось прочитать базовые результаты: " << baselinePath << endl;
+            return 2;
+        }
+        int regressions = compareWithBaseline(results, baseline, tolerancePercent / 100.0);
+        cout << "Ухудшений относительно " << baselinePath << ": " << regressions << "\n";
+        failed = failed || regressions > 0;
+    }
+    return failed ? 1 : 0;
+}
@@ -1,11 +1,30 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <queue>
 #include <unordered_map>
 #include <vector>
 #include <bitset>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <span>
+#include <bit>
+#include <sstream>
+#include <memory>
+#include "thread_pool.h"
+#include "mapped_file.h"
+#include "histogram.h"
+#include "batch_cli.h"
+#include "stage_stats.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 using namespace std;
 
 // ===================== 工具函数 =====================
@@ -27,135 +46,230 @@ void writeFile(const string& filename, const string& data) {
     file.write(data.c_str(), data.size());
 }
 
-int findOptimalBlockSize(const string& text) {
-    int n = text.size();
-    if (n < 1024) return 1;
-    if (n < 4096) return 2;
-    if (n < 16384) return 4;
-    return 8;
+// Кусок результата в поток; время и объём идут в статистику записи (stage_stats.h).
+void writeChunk(ostream& out, const string& data) {
+    StageTimer timer(STAGE_WRITE);
+    out.write(data.data(), data.size());
+    stageCount(STAT_BYTES_OUT, data.size());
 }
 
-// ===================== Huffman =====================
-struct Node {
-    char ch;
-    int freq;
-    Node* left;
-    Node* right;
-    Node(char c, int f) : ch(c), freq(f), left(nullptr), right(nullptr) {}
-};
-struct Compare {
-    bool operator()(Node* a, Node* b) { return a->freq > b->freq; }
+struct Dictionary;
+
+struct BlockPolicy {
+    size_t blockSize;
+    unsigned threads;
+    int lzLevel = 0;  // уровень LZ77 (см. LZ_LEVELS), 0 — без поиска повторов
+    const Dictionary* dictionary = nullptr;  // код статического словаря вместо таблиц в архиве
 };
 
-void buildHuffmanCodes(Node* root, const string& str, unordered_map<char, string>& codes) {
-    if (!root) return;
-    if (!root->left && !root->right)
-        codes[root->ch] = str;
-    buildHuffmanCodes(root->left, str + "0", codes);
-    buildHuffmanCodes(root->right, str + "1", codes);
-}
+// Размер блока и число потоков по длине входа: небольшие файлы идут одним блоком,
+// крупные делятся так, чтобы на каждый поток пришлось около четырёх блоков от 256 КБ до 4 МБ.
+BlockPolicy chooseBlockPolicy(size_t n) {
+    const size_t minBlock = 256 * 1024;
+    const size_t maxBlock = 4 * 1024 * 1024;
+    unsigned hw = max(1u, thread::hardware_concurrency());
+    if (n <= minBlock) return { max<size_t>(n, 1), 1 };
 
-void deleteTree(Node* root) {
-    if (!root) return;
-    deleteTree(root->left);
-    deleteTree(root->right);
-    delete root;
+    size_t blockSize = min(maxBlock, max(minBlock, n / (size_t(hw) * 4)));
+    blockSize = (blockSize + 0xFFFF) & ~size_t(0xFFFF);
+    size_t blocks = (n + blockSize - 1) / blockSize;
+    return { blockSize, unsigned(min<size_t>(hw, blocks)) };
 }
 
-void compressHuffman(const string& inputFile, const string& outputFile) {
-    string text = readFile(inputFile);
-    if (text.empty()) {
-        cerr << "Ошибка: пустой файл!" << endl;
-        return;
-    }
+// ===================== 表驱动解码 =====================
+// Префиксный код одного символа: биты кода прижаты к младшим разрядам code.
+struct PrefixCode {
+    unsigned char ch;
+    uint64_t code;
+    int len;
+};
 
-    unordered_map<char, int> freq;
-    for (char c : text) freq[c]++;
+const int PRIMARY_BITS = 11;   // ширина первичной таблицы
+const int MAX_CODE_LEN = 56;   // столько бит гарантированно даёт одно 64-битное чтение
+const int MAX_MULTI_SYMBOLS = 4;
 
-    priority_queue<Node*, vector<Node*>, Compare> pq;
-    for (auto& p : freq)
-        pq.push(new Node(p.first, p.second));
+// Запись таблицы: либо 1..4 готовых символа, либо ссылка на подтаблицу (count == 0, bits != 0),
+// либо пустая ячейка неполного кода (count == 0, bits == 0).
+struct DecodeEntry {
+    uint32_t syms;      // символы по байту, первый в младшем; у ссылки — смещение подтаблицы
+    uint8_t count;
+    uint8_t bits;       // сколько бит снимает запись; у ссылки — ширина подтаблицы
+    uint8_t firstBits;  // длина кода первого символа
+};
 
-    while (pq.size() > 1) {
-        Node* left = pq.top(); pq.pop();
-        Node* right = pq.top(); pq.pop();
-        Node* node = new Node('\0', left->freq + right->freq);
-        node->left = left;
-        node->right = right;
-        pq.push(node);
-    }
+struct DecodeTable {
+    vector<DecodeEntry> entries;  // первичная таблица в начале, подтаблицы следом
+    int minLen;                   // длина самого короткого кода, 0 — кодов нет
+};
 
-    Node* root = pq.top();
-    unordered_map<char, string> codes;
-    buildHuffmanCodes(root, "", codes);
+static void fillDecodeTable(DecodeTable& table, const vector<const PrefixCode*>& group,
+                            int consumed, size_t base, int width) {
+    vector<vector<const PrefixCode*>> longer(size_t(1) << width);
+    for (const PrefixCode* c : group) {
+        int rem = c->len - consumed;
+        uint64_t bits = c->code & ((uint64_t(1) << rem) - 1);
+        if (rem <= width) {
+            size_t first = size_t(bits) << (width - rem);
+            size_t span = size_t(1) << (width - rem);
+            for (size_t k = 0; k < span; ++k)
+                table.entries[base + first + k] = { c->ch, 1, uint8_t(rem), uint8_t(rem) };
+        }
+        else {
+            longer[size_t(bits >> (rem - width))].push_back(c);
+        }
+    }
+    for (size_t idx = 0; idx < longer.size(); ++idx) {
+        if (longer[idx].empty()) continue;
+        int maxRem = 0;
+        for (const PrefixCode* c : longer[idx]) maxRem = max(maxRem, c->len - consumed - width);
+        int subWidth = min(PRIMARY_BITS, maxRem);
+        size_t offset = table.entries.size();
+        table.entries.resize(offset + (size_t(1) << subWidth), DecodeEntry{ 0, 0, 0, 0 });
+        table.entries[base + idx] = { uint32_t(offset), 0, uint8_t(subWidth), 0 };
+        fillDecodeTable(table, longer[idx], consumed + width, offset, subWidth);
+    }
+}
 
-    string encoded;
-    for (char c : text) encoded += codes[c];
+// Строит многоуровневую таблицу для произвольного префиксного кода.
+// Короткие коды в первичной таблице склеиваются, чтобы один поиск выдавал до 4 символов;
+// без multiSymbol (таблица зависит от предыдущего символа) склейка не нужна.
+bool buildDecodeTable(const vector<PrefixCode>& codes, DecodeTable& table, bool multiSymbol = true) {
+    table.entries.assign(size_t(1) << PRIMARY_BITS, DecodeEntry{ 0, 0, 0, 0 });
+    table.minLen = 0;
+    vector<const PrefixCode*> group;
+    for (const PrefixCode& c : codes) {
+        if (c.len > MAX_CODE_LEN) return false;
+        if (c.len == 0) continue;
+        group.push_back(&c);
+        if (table.minLen == 0 || c.len < table.minLen) table.minLen = c.len;
+    }
+    fillDecodeTable(table, group, 0, 0, PRIMARY_BITS);
+    if (!multiSymbol) return true;
 
-    string byteData;
-    for (size_t i = 0; i < encoded.size(); i += 8) {
-        string byteStr = encoded.substr(i, 8);
-        while (byteStr.size() < 8) byteStr += '0';
-        bitset<8> bits(byteStr);
-        byteData.push_back(static_cast<char>(bits.to_ulong()));
+    const size_t mask = (size_t(1) << PRIMARY_BITS) - 1;
+    vector<DecodeEntry> single(table.entries.begin(), table.entries.begin() + mask + 1);
+    for (size_t idx = 0; idx <= mask; ++idx) {
+        DecodeEntry e = single[idx];
+        if (e.count != 1) continue;
+        int used = e.bits;
+        while (e.count < MAX_MULTI_SYMBOLS && used < PRIMARY_BITS) {
+            const DecodeEntry& next = single[(idx << used) & mask];
+            if (next.count != 1 || next.bits > PRIMARY_BITS - used) break;
+            e.syms |= next.syms << (8 * e.count);
+            e.count++;
+            used += next.bits;
+        }
+        e.bits = uint8_t(used);
+        table.entries[idx] = e;
     }
+    return true;
+}
 
-    ofstream out(outputFile, ios::binary);
-    string header = "HUFF";
-    out.write(header.c_str(), 4);
+static inline uint64_t loadBE64(const uint8_t* p) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return __builtin_bswap64(v);
+#else
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+    return v;
+#endif
+}
 
-    size_t dictSize = codes.size();
-    out.write(reinterpret_cast<char*>(&dictSize), sizeof(size_t));
-    for (auto& p : codes) {
-        out.put(p.first);
-        size_t len = p.second.size();
-        out.write(reinterpret_cast<char*>(&len), sizeof(size_t));
-        out.write(p.second.c_str(), len);
+// 64 бита потока начиная с бита pos (старший бит — первый); за концом данных — нули.
+static inline uint64_t peekBits(const uint8_t* data, size_t size, uint64_t pos) {
+    size_t byte = size_t(pos >> 3);
+    uint64_t v = 0;
+    if (byte + 8 <= size) {
+        v = loadBE64(data + byte);
     }
-    out.write(byteData.c_str(), byteData.size());
-    out.close();
-
-    deleteTree(root);
-    cout << "Файл успешно заархивирован (Хаффман): " << outputFile << endl;
+    else {
+        for (int i = 0; i < 8; ++i) v = (v << 8) | (byte + i < size ? data[byte + i] : 0);
+    }
+    return v << (pos & 7);
+}
 
-    ifstream orig(inputFile, ios::binary | ios::ate);
-    ifstream comp(outputFile, ios::binary | ios::ate);
-    double origSize = orig.tellg();
-    double compSize = comp.tellg();
-    orig.close(); comp.close();
-    cout << "Размер исходного файла: " << origSize << " байт\n";
-    cout << "Размер сжатого файла: " << compSize << " байт\n";
-    cout << "Коэффициент сжатия: " << (compSize / origSize * 100) << "%\n";
+// Находит запись для кода в позиции pos; consumed — сколько бит снято ссылками на подтаблицы.
+static inline const DecodeEntry* lookupEntry(const DecodeTable& table, const uint8_t* data, size_t size,
+                                             uint64_t pos, int& consumed) {
+    uint64_t window = peekBits(data, size, pos);
+    const DecodeEntry* e = &table.entries[size_t(window >> (64 - PRIMARY_BITS))];
+    consumed = 0;
+    int width = PRIMARY_BITS;
+    while (e->count == 0) {
+        if (e->bits == 0) return nullptr;
+        consumed += width;
+        width = e->bits;
+        window = peekBits(data, size, pos + consumed);
+        e = &table.entries[e->syms + size_t(window >> (64 - width))];
+    }
+    return e;
 }
 
-void decompressHuffman(const string& inputFile, const string& outputFile) {
-    ifstream in(inputFile, ios::binary);
-    if (!in.is_open()) {
-        cerr << "Ошибка открытия файла!" << endl;
-        return;
+// Декодирует не более maxSymbols символов из первых totalBits бит потока в out.
+// Возвращает число символов; в out пишется не дальше out[maxSymbols - 1].
+size_t decodeInto(const DecodeTable& table, const uint8_t* data, size_t size,
+                  uint64_t totalBits, char* out, size_t maxSymbols) {
+    totalBits = min<uint64_t>(totalBits, uint64_t(size) * 8);
+    size_t produced = 0;
+    uint64_t pos = 0;
+
+    // Основной цикл: за итерацию уходит не больше MAX_CODE_LEN бит, так что хвост потока не задевается.
+    while (pos + 2 * 64 <= totalBits && produced + MAX_MULTI_SYMBOLS <= maxSymbols) {
+        int consumed;
+        const DecodeEntry* e = lookupEntry(table, data, size, pos, consumed);
+        if (!e) break;
+        memcpy(out + produced, &e->syms, sizeof(e->syms));
+        produced += e->count;
+        pos += consumed + e->bits;
     }
 
-    char header[5] = {};
-    in.read(header, 4);
-    if (string(header) != "HUFF") {
-        cerr << "Неверный формат файла!" << endl;
-        return;
+    // Хвост: по одному символу с проверкой, что код целиком лежит в потоке.
+    while (produced < maxSymbols) {
+        int consumed;
+        const DecodeEntry* e = lookupEntry(table, data, size, pos, consumed);
+        if (!e || pos + consumed + e->firstBits > totalBits) break;
+        out[produced++] = char(e->syms & 0xFF);
+        pos += consumed + e->firstBits;
     }
+    return produced;
+}
+
+// То же для потока неизвестной длины: буфер берётся по верхней оценке totalBits / minLen.
+void decodeBits(const DecodeTable& table, const uint8_t* data, size_t size,
+                uint64_t totalBits, size_t maxSymbols, string& out) {
+    totalBits = min<uint64_t>(totalBits, uint64_t(size) * 8);
+    size_t bound = table.minLen ? size_t(min<uint64_t>(totalBits / table.minLen, maxSymbols)) : 0;
+    out.resize(bound);
+    out.resize(decodeInto(table, data, size, totalBits, &out[0], bound));
+}
 
+// Словарь старого формата: size_t число кодов, затем символ, size_t длина и код из '0'/'1'.
+bool readLegacyDictionary(istream& in, vector<PrefixCode>& codes) {
     size_t dictSize;
-    in.read(reinterpret_cast<char*>(&dictSize), sizeof(size_t));
-    unordered_map<string, char> reverseCodes;
+    if (!in.read(reinterpret_cast<char*>(&dictSize), sizeof(size_t)) || dictSize > 256) return false;
     for (size_t i = 0; i < dictSize; ++i) {
         char c = in.get();
         size_t len;
-        in.read(reinterpret_cast<char*>(&len), sizeof(size_t));
+        if (!in.read(reinterpret_cast<char*>(&len), sizeof(size_t)) || len > 256) return false;
         string code(len, '\0');
         in.read(&code[0], len);
-        reverseCodes[code] = c;
+        PrefixCode pc = { static_cast<unsigned char>(c), 0, int(len) };
+        for (char bit : code) pc.code = (pc.code << 1) | (bit == '1');
+        codes.push_back(pc);
     }
+    return bool(in);
+}
 
-    string encodedBytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
-    in.close();
+// Прежний побитовый декодер через строки; оставлен как эталон для сравнения скорости.
+string decodeBitsLegacy(const vector<PrefixCode>& codes, const vector<uint8_t>& encodedBytes) {
+    unordered_map<string, char> reverseCodes;
+    for (const PrefixCode& pc : codes) {
+        string code;
+        for (int i = pc.len - 1; i >= 0; --i) code += ((pc.code >> i) & 1) ? '1' : '0';
+        reverseCodes[code] = static_cast<char>(pc.ch);
+    }
 
     string bitStream;
     for (unsigned char c : encodedBytes) {
@@ -171,56 +285,87 @@ void decompressHuffman(const string& inputFile, const string& outputFile) {
             current.clear();
         }
     }
-
-    writeFile(outputFile, decoded);
-    cout << "Файл успешно разархивирован (Хаффман): " << outputFile << endl;
+    return decoded;
 }
 
-// ===================== Shannon–Fano =====================
-struct SFNode {
-    char ch;
-    int freq;
-    string code;
+// ===================== 按位打包编码 =====================
+// Плоская таблица кодов: индекс — байт, биты кода прижаты к младшим разрядам.
+struct CodeEntry {
+    uint64_t code;
+    int len;
 };
 
-bool compareSF(const SFNode& a, const SFNode& b) {
-    return a.freq > b.freq;
+bool makeEncodeTable(const unordered_map<char, string>& codes, CodeEntry table[256]) {
+    for (int i = 0; i < 256; ++i) table[i] = { 0, 0 };
+    for (auto& p : codes) {
+        if (p.second.size() > size_t(MAX_CODE_LEN)) return false;
+        CodeEntry& e = table[static_cast<unsigned char>(p.first)];
+        e.len = int(p.second.size());
+        for (char bit : p.second) e.code = (e.code << 1) | uint64_t(bit == '1');
+    }
+    return true;
 }
 
-void buildShannonFano(vector<SFNode>& symbols, int left, int right) {
-    if (left >= right) return;
-    int total = 0;
-    for (int i = left; i <= right; i++) total += symbols[i].freq;
-    int half = total / 2;
-    int sum = 0, split = left;
-    for (int i = left; i <= right; i++) {
-        sum += symbols[i].freq;
-        if (sum >= half) { split = i; break; }
+// Накопитель на 64 бита; каждые полные 32 бита сбрасываются в выходной буфер старшим битом вперёд.
+struct BitWriter {
+    uint8_t* out;
+    uint64_t acc;
+    int count;
+};
+
+static inline void putBits(BitWriter& w, uint64_t code, int len) {
+    if (len > 32) {
+        putBits(w, code >> 32, len - 32);
+        code &= 0xFFFFFFFFu;
+        len = 32;
+    }
+    w.acc = (w.acc << len) | code;
+    w.count += len;
+    if (w.count >= 32) {
+        w.count -= 32;
+        uint32_t v = uint32_t(w.acc >> w.count);
+        w.out[0] = uint8_t(v >> 24);
+        w.out[1] = uint8_t(v >> 16);
+        w.out[2] = uint8_t(v >> 8);
+        w.out[3] = uint8_t(v);
+        w.out += 4;
     }
-    for (int i = left; i <= split; i++) symbols[i].code += "0";
-    for (int i = split + 1; i <= right; i++) symbols[i].code += "1";
-    buildShannonFano(symbols, left, split);
-    buildShannonFano(symbols, split + 1, right);
 }
 
-void compressShannonFano(const string& inputFile, const string& outputFile) {
-    string text = readFile(inputFile);
-    if (text.empty()) {
-        cerr << "Ошибка: пустой файл!" << endl;
-        return;
+static inline void flushBits(BitWriter& w) {
+    while (w.count >= 8) {
+        w.count -= 8;
+        *w.out++ = uint8_t(w.acc >> w.count);
     }
+    if (w.count > 0) *w.out++ = uint8_t(w.acc << (8 - w.count));
+    w.count = 0;
+}
 
-    unordered_map<char, int> freq;
-    for (char c : text) freq[c]++;
+// Прежний подсчёт одним массивом; оставлен для сравнения скорости с byteHistogram.
+void countFrequenciesLegacy(const uint8_t* data, size_t n, size_t freq[256]) {
+    for (int i = 0; i < 256; ++i) freq[i] = 0;
+    for (size_t i = 0; i < n; ++i) freq[data[i]]++;
+}
 
-    vector<SFNode> symbols;
-    for (auto& p : freq) symbols.push_back({ p.first, p.second, "" });
-    sort(symbols.begin(), symbols.end(), compareSF);
-    buildShannonFano(symbols, 0, symbols.size() - 1);
+uint64_t encodedBitCount(const size_t freq[256], const CodeEntry table[256]) {
+    uint64_t totalBits = 0;
+    for (int i = 0; i < 256; ++i) totalBits += uint64_t(freq[i]) * table[i].len;
+    return totalBits;
+}
 
-    unordered_map<char, string> codes;
-    for (auto& s : symbols) codes[s.ch] = s.code;
+// Дописывает в out упакованные биты; последний байт добит нулями.
+void encodeBits(const uint8_t* data, size_t n, const CodeEntry table[256], uint64_t totalBits, string& out) {
+    size_t start = out.size();
+    size_t bytes = size_t((totalBits + 7) / 8);
+    out.resize(start + bytes + 4);
+    BitWriter w = { reinterpret_cast<uint8_t*>(&out[start]), 0, 0 };
+    for (size_t i = 0; i < n; ++i) putBits(w, table[data[i]].code, table[data[i]].len);
+    flushBits(w);
+    out.resize(start + bytes);
+}
 
+// Прежняя упаковка через строку из '0'/'1' и bitset; оставлена для сравнения скорости.
+string encodeBitsLegacy(const string& text, unordered_map<char, string>& codes) {
     string encoded;
     for (char c : text) encoded += codes[c];
 
@@ -231,24 +376,10 @@ void compressShannonFano(const string& inputFile, const string& outputFile) {
         bitset<8> bits(byteStr);
         byteData.push_back(static_cast<char>(bits.to_ulong()));
     }
+    return byteData;
+}
 
-    ofstream out(outputFile, ios::binary);
-    string header = "SFAN";
-    out.write(header.c_str(), 4);
-
-    size_t dictSize = codes.size();
-    out.write(reinterpret_cast<char*>(&dictSize), sizeof(size_t));
-    for (auto& p : codes) {
-        out.put(p.first);
-        size_t len = p.second.size();
-        out.write(reinterpret_cast<char*>(&len), sizeof(size_t));
-        out.write(p.second.c_str(), len);
-    }
-    out.write(byteData.c_str(), byteData.size());
-    out.close();
-
-    cout << "Файл успешно заархивирован (Шеннон-Фано): " << outputFile << endl;
-
+void printCompressionStats(const string& inputFile, const string& outputFile, double seconds) {
     ifstream orig(inputFile, ios::binary | ios::ate);
     ifstream comp(outputFile, ios::binary | ios::ate);
     double origSize = orig.tellg();
@@ -257,89 +388,2288 @@ void compressShannonFano(const string& inputFile, const string& outputFile) {
     cout << "Размер исходного файла: " << origSize << " байт\n";
     cout << "Размер сжатого файла: " << compSize << " байт\n";
     cout << "Коэффициент сжатия: " << (compSize / origSize * 100) << "%\n";
+    cout << "Время: " << seconds << " с, " << (seconds > 0 ? origSize / 1048576.0 / seconds : 0) << " МБ/с\n";
 }
 
-void decompressShannonFano(const string& inputFile, const string& outputFile) {
-    ifstream in(inputFile, ios::binary);
-    if (!in.is_open()) {
-        cerr << "Ошибка открытия файла!" << endl;
-        return;
+// ===================== 容器格式 =====================
+// Формат HUF2/SFA2/ANS2 (все числа little-endian): сигнатура[4], флаги u8, далее
+//   флаги == 0 (один поток): длина исходных данных u64, CRC32 исходных данных u32,
+//     таблица длин кодов, затем биты канонического кода старшим битом вперёд;
+//   флаги & FLAG_BLOCKS (блоки): [общая таблица длин, если FLAG_SHARED_TABLE],
+//     блоки: длина u32, размер тела u32, CRC32 блока u32, тело = [таблица длин] + биты,
+//     блок нулевой длины как признак конца, индекс: число блоков u32, смещения блоков u64[],
+//     общая длина u64, размер индекса u32 (последние 4 байта файла).
+// При FLAG_MODEL тело потока или блока начинается с байта модели: MODEL_ORDER0 — таблица длин
+// (или общая) и биты, как без флага; MODEL_CONTEXT — битовая карта встреченных предыдущих байтов [32],
+// по таблице длин на каждый из них, затем биты, где код байта выбирается по предыдущему;
+// MODEL_ANS — нормированные частоты и поток tANS (архивы ANS2, см. раздел tANS); MODEL_LZ — потоки
+// литералов и совпадений LZ77 (см. раздел LZ77).
+// При FLAG_DICTIONARY архив ссылается на статический словарь (см. раздел 静态字典): id словаря u32
+// стоит в потоке сразу за CRC32, и MODEL_ORDER0 кодируется кодом словаря без своей таблицы, а в блочном
+// архиве (вместе с FLAG_SHARED_TABLE) — на месте общей таблицы длин.
+// Таблица длин: максимальная длина u8, битовая карта присутствующих байтов [32],
+// далее длины присутствующих символов по возрастанию — по полбайта, если maxLen <= 15, иначе по байту.
+const size_t CONTAINER_HEADER_SIZE = 4 + 1 + 8 + 4;
+const size_t BLOCK_HEADER_SIZE = 4 + 4 + 4;
+const uint8_t FLAG_BLOCKS = 1;
+const uint8_t FLAG_SHARED_TABLE = 2;
+const uint8_t FLAG_MODEL = 4;
+const uint8_t FLAG_DICTIONARY = 8;
+const uint8_t MODEL_ORDER0 = 0;
+const uint8_t MODEL_CONTEXT = 1;
+const uint8_t MODEL_ANS = 2;
+const uint8_t MODEL_LZ = 3;
+
+static array<uint32_t, 256> makeCrcTable() {
+    array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
     }
+    return table;
+}
 
-    char header[5] = {};
-    in.read(header, 4);
-    if (string(header) != "SFAN") {
-        cerr << "Неверный формат файла!" << endl;
-        return;
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static const array<uint32_t, 256> table = makeCrcTable();
+    StageTimer timer(STAGE_CRC);
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void putLE(string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(char((value >> (8 * i)) & 0xFF));
+}
+
+uint64_t getLE(const uint8_t* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = bytes - 1; i >= 0; --i) value = (value << 8) | p[i];
+    return value;
+}
+
+// Строит длины кодов по частотам; false, если код вышел длиннее MAX_CODE_LEN.
+typedef bool (*LengthBuilder)(const size_t freq[256], uint8_t lengths[256]);
+
+// Канонические коды: символы упорядочены по (длина, значение байта).
+void canonicalCodes(const uint8_t lengths[256], CodeEntry table[256]) {
+    int lengthCount[MAX_CODE_LEN + 1] = {};
+    for (int i = 0; i < 256; ++i) lengthCount[lengths[i]]++;
+    lengthCount[0] = 0;
+    uint64_t next[MAX_CODE_LEN + 2] = {};
+    uint64_t code = 0;
+    for (int len = 1; len <= MAX_CODE_LEN; ++len) {
+        code = (code + lengthCount[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (int i = 0; i < 256; ++i) {
+        table[i] = { 0, lengths[i] };
+        if (lengths[i]) table[i].code = next[lengths[i]]++;
     }
+}
 
-    size_t dictSize;
-    in.read(reinterpret_cast<char*>(&dictSize), sizeof(size_t));
-    unordered_map<string, char> reverseCodes;
-    for (size_t i = 0; i < dictSize; ++i) {
-        char c = in.get();
-        size_t len;
-        in.read(reinterpret_cast<char*>(&len), sizeof(size_t));
-        string code(len, '\0');
-        in.read(&code[0], len);
-        reverseCodes[code] = c;
+void writeCodeLengths(string& out, const uint8_t lengths[256]) {
+    uint8_t maxLen = *max_element(lengths, lengths + 256);
+    out.push_back(char(maxLen));
+    uint8_t bitmap[32] = {};
+    for (int i = 0; i < 256; ++i)
+        if (lengths[i]) bitmap[i >> 3] |= uint8_t(1 << (i & 7));
+    out.append(reinterpret_cast<char*>(bitmap), 32);
+
+    bool nibbles = maxLen <= 15;
+    int pending = -1;
+    for (int i = 0; i < 256; ++i) {
+        if (!lengths[i]) continue;
+        if (!nibbles) out.push_back(char(lengths[i]));
+        else if (pending < 0) pending = lengths[i];
+        else {
+            out.push_back(char((pending << 4) | lengths[i]));
+            pending = -1;
+        }
     }
+    if (pending >= 0) out.push_back(char(pending << 4));
+}
 
-    string encodedBytes((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
-    in.close();
+bool readCodeLengths(const uint8_t*& p, const uint8_t* end, uint8_t lengths[256]) {
+    if (end - p < 33) return false;
+    int maxLen = *p++;
+    const uint8_t* bitmap = p;
+    p += 32;
+    if (maxLen > MAX_CODE_LEN) return false;
 
-    string bitStream;
-    for (unsigned char c : encodedBytes) {
-        bitset<8> bits(c);
-        bitStream += bits.to_string();
+    bool nibbles = maxLen <= 15;
+    int half = 0;
+    for (int i = 0; i < 256; ++i) {
+        lengths[i] = 0;
+        if (!(bitmap[i >> 3] & (1 << (i & 7)))) continue;
+        if (p >= end) return false;
+        if (!nibbles) lengths[i] = *p++;
+        else if (half == 0) { lengths[i] = *p >> 4; half = 1; }
+        else { lengths[i] = *p++ & 0x0F; half = 0; }
+        if (lengths[i] == 0 || lengths[i] > maxLen) return false;
     }
+    if (half) p++;
+    return true;
+}
 
-    string decoded, current;
-    for (char bit : bitStream) {
-        current += bit;
-        if (reverseCodes.count(current)) {
-            decoded += reverseCodes[current];
-            current.clear();
+size_t codeLengthsSize(const uint8_t lengths[256]) {
+    int used = 0, maxLen = 0;
+    for (int i = 0; i < 256; ++i) {
+        if (lengths[i]) used++;
+        maxLen = max(maxLen, int(lengths[i]));
+    }
+    return 1 + 32 + (maxLen <= 15 ? (used + 1) / 2 : used);
+}
+
+// Статический словарь: префиксный код, обученный на образцах небольших сообщений (huffandshf -t).
+// Архив хранит только его id, а таблицы кодера и декодера строятся один раз при загрузке словаря.
+struct Dictionary {
+    uint32_t id = 0;  // CRC32 таблицы длин в файле словаря
+    uint8_t lengths[256];
+    CodeEntry codes[256];
+    DecodeTable decode;
+};
+
+// ===================== 一阶上下文 =====================
+// Контекстная модель первого порядка: код байта выбирается по предыдущему байту (в начале потока
+// или блока предыдущим считается 0). На повторяющихся текстах и журналах это заметно короче одной
+// таблицы, но каждый встреченный контекст стоит своей таблицы длин, поэтому модель берётся по
+// точному размеру результата. На входах короче CONTEXT_MIN_INPUT таблицы заведомо дороже выигрыша.
+const size_t CONTEXT_MIN_INPUT = 4096;
+
+struct ContextCode {
+    vector<array<size_t, 256>> freq;  // [предыдущий байт][байт]
+    vector<array<uint8_t, 256>> lengths;
+    vector<array<CodeEntry, 256>> table;
+    uint8_t used[32];                 // битовая карта встреченных контекстов
+    uint64_t payloadBits;
+};
+
+// Энтропия в битах: ни один префиксный код не запишет эти символы короче.
+double entropyBits(const size_t freq[256]) {
+    size_t total = 0;
+    double sum = 0;
+    for (int s = 0; s < 256; ++s) {
+        if (!freq[s]) continue;
+        total += freq[s];
+        sum += double(freq[s]) * log2(double(freq[s]));
+    }
+    return total ? double(total) * log2(double(total)) - sum : 0;
+}
+
+// Коды по контекстам; в bodyBits — размер тела с байтом модели, картой и таблицами.
+// Возвращает false, если модель не строится или заведомо не короче limitBits: сначала по
+// энтропии и наименьшему размеру таблиц (это дешевле, чем строить 256 кодов на
+// несжимаемых данных), затем по точному размеру.
+bool buildContextCode(const uint8_t* data, size_t n, LengthBuilder build, uint64_t limitBits,
+                      ContextCode& code, uint64_t& bodyBits) {
+    code.freq.resize(256);
+    code.lengths.resize(256);
+    code.table.resize(256);
+    StageTimer timer(STAGE_BUILD);
+    {
+        StageTimer countTimer(STAGE_COUNT);
+        pairHistogram(data, n, code.freq.data());
+    }
+    double bound = 8 * (1 + 32);
+    for (int c = 0; c < 256; ++c) {
+        const size_t* f = code.freq[c].data();
+        if (any_of(f, f + 256, [](size_t v) { return v != 0; })) bound += 8 * (1 + 32) + entropyBits(f);
+    }
+    if (bound >= double(limitBits)) return false;
+
+    memset(code.used, 0, sizeof(code.used));
+    code.payloadBits = 0;
+    bodyBits = 8 * (1 + 32);
+    for (int c = 0; c < 256; ++c) {
+        const size_t* f = code.freq[c].data();
+        if (all_of(f, f + 256, [](size_t v) { return v == 0; })) continue;
+        code.used[c >> 3] |= uint8_t(1 << (c & 7));
+        if (!build(f, code.lengths[c].data())) return false;
+        noteCodeLengths(code.lengths[c].data());
+        canonicalCodes(code.lengths[c].data(), code.table[c].data());
+        code.payloadBits += encodedBitCount(f, code.table[c].data());
+        bodyBits += 8 * codeLengthsSize(code.lengths[c].data());
+    }
+    bodyBits += code.payloadBits;
+    return bodyBits < limitBits;
+}
+
+void encodeContextBits(const uint8_t* data, size_t n, const ContextCode& code, string& out) {
+    out.append(reinterpret_cast<const char*>(code.used), 32);
+    for (int c = 0; c < 256; ++c)
+        if (code.used[c >> 3] & (1 << (c & 7))) writeCodeLengths(out, code.lengths[c].data());
+    size_t start = out.size();
+    size_t bytes = size_t((code.payloadBits + 7) / 8);
+    out.resize(start + bytes + 4);
+    BitWriter w = { reinterpret_cast<uint8_t*>(&out[start]), 0, 0 };
+    uint8_t prev = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const CodeEntry& e = code.table[prev][data[i]];
+        putBits(w, e.code, e.len);
+        prev = data[i];
+    }
+    flushBits(w);
+    out.resize(start + bytes);
+}
+
+// ===================== 非对称数字系统 (tANS) =====================
+// Табличный ANS (как FSE): частоты нормируются к L = 2^tableLog, состояние — позиция в таблице,
+// где каждый символ занимает norm[s] мест. Символ с вероятностью p стоит около -log2(p) бит
+// с дробной частью, поэтому на перекошенных распределениях выход ближе к энтропии, чем у
+// префиксного кода, теряющего до бита на символ. Чётные и нечётные символы идут через два
+// состояния, так что цепочки зависимостей двух декодеров перекрываются. Кодер идёт с конца
+// и пишет биты от младших к старшим, декодер читает поток с конца к началу.
+// Тело MODEL_ANS: tableLog u8, битовая карта присутствующих байтов [32], norm - 1 для каждого
+// по возрастанию (по 7 бит, старший бит байта — продолжение), затем поток: биты символов,
+// конечные состояния кодера (второе, затем первое) по tableLog бит и единичный бит-метка.
+const int ANS_TABLE_LOG = 12;
+const int ANS_MIN_TABLE_LOG = 5;
+const LengthBuilder TANS_CODER = nullptr;  // вместо построителя длин кодов — кодер tANS
+
+static inline uint64_t loadLE64(const uint8_t* p) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+#else
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+#endif
+}
+
+static inline void storeLE64(uint8_t* p, uint64_t v) {
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, &v, sizeof(v));
+#else
+    for (int i = 0; i < 8; ++i) p[i] = uint8_t(v >> (8 * i));
+#endif
+}
+
+// Частоты к сумме 2^tableLog, у каждого встреченного символа не меньше 1. Расхождение после
+// округления раздаётся по единице туда, где она меньше всего удлиняет выход.
+bool normalizeFrequencies(const size_t freq[256], int tableLog, uint16_t norm[256]) {
+    size_t total = 0;
+    for (int s = 0; s < 256; ++s) total += freq[s];
+    if (total == 0) return false;
+    const int L = 1 << tableLog;
+    int sum = 0;
+    for (int s = 0; s < 256; ++s) {
+        norm[s] = freq[s] ? uint16_t(max<long long>(1, llround(double(freq[s]) * L / double(total)))) : 0;
+        sum += norm[s];
+    }
+    while (sum != L) {
+        int step = sum < L ? 1 : -1, best = -1;
+        double bestCost = 0;
+        for (int s = 0; s < 256; ++s) {
+            if (!freq[s] || norm[s] + step == 0) continue;
+            double cost = double(freq[s]) * log2(double(norm[s]) / double(norm[s] + step));
+            if (best < 0 || cost < bestCost) {
+                best = s;
+                bestCost = cost;
+            }
         }
+        if (best < 0) return false;
+        norm[best] = uint16_t(norm[best] + step);
+        sum += step;
     }
+    return true;
+}
 
-    writeFile(outputFile, decoded);
-    cout << "Файл успешно разархивирован (Шеннон-Фано): " << outputFile << endl;
+void writeAnsTable(string& out, int tableLog, const uint16_t norm[256]) {
+    out.push_back(char(tableLog));
+    uint8_t used[32] = {};
+    for (int s = 0; s < 256; ++s)
+        if (norm[s]) used[s >> 3] |= uint8_t(1 << (s & 7));
+    out.append(reinterpret_cast<const char*>(used), 32);
+    for (int s = 0; s < 256; ++s) {
+        if (!norm[s]) continue;
+        unsigned v = norm[s] - 1u;
+        for (; v >= 0x80; v >>= 7) out.push_back(char(0x80 | (v & 0x7F)));
+        out.push_back(char(v));
+    }
 }
 
-// ===================== 主函数 =====================
-int main() {
-    cout << "Выберите действие:\n";
-    cout << "1 - Заархивировать файл\n";
-    cout << "2 - Разархивировать файл\n";
-    int choice;
-    cin >> choice;
+bool readAnsTable(const uint8_t*& p, const uint8_t* end, int& tableLog, uint16_t norm[256]) {
+    if (end - p < 1 + 32) return false;
+    tableLog = *p++;
+    if (tableLog < ANS_MIN_TABLE_LOG || tableLog > ANS_TABLE_LOG) return false;
+    const uint8_t* used = p;
+    p += 32;
+    unsigned sum = 0;
+    for (int s = 0; s < 256; ++s) {
+        norm[s] = 0;
+        if (!(used[s >> 3] & (1 << (s & 7)))) continue;
+        unsigned v = 0;
+        for (int shift = 0;; shift += 7) {
+            if (p >= end || shift > 14) return false;
+            v |= unsigned(*p & 0x7F) << shift;
+            if (!(*p++ & 0x80)) break;
+        }
+        if (v >= (1u << tableLog)) return false;
+        norm[s] = uint16_t(v + 1);
+        sum += norm[s];
+    }
+    return sum == (1u << tableLog);
+}
 
-    string inputFile, outputFile;
-    cout << "Введите имя входного файла: ";
-    cin >> inputFile;
-    cout << "Введите имя выходного файла: ";
-    cin >> outputFile;
+// Раскладка символов по таблице: шаг взаимно прост с L, так что каждая позиция занимается один раз,
+// а места одного символа разбросаны по всей таблице.
+static void spreadSymbols(int tableLog, const uint16_t norm[256], uint8_t* spread) {
+    const unsigned L = 1u << tableLog, step = (L >> 1) + (L >> 3) + 3;
+    unsigned pos = 0;
+    for (int s = 0; s < 256; ++s)
+        for (unsigned k = 0; k < norm[s]; ++k) {
+            spread[pos] = uint8_t(s);
+            pos = (pos + step) & (L - 1);
+        }
+}
 
-    if (choice == 1) {
-        cout << "Выберите алгоритм:\n1 - Хаффман\n2 - Шеннон-Фано\n";
-        int alg;
-        cin >> alg;
+// Состояние кодера X лежит в [L, 2L). Для символа s уходит nb = (X + deltaNbBits) >> 16 младших бит,
+// и X >> nb попадает в [norm[s], 2 norm[s]) — номер места символа в stateTable.
+struct AnsEncoder {
+    struct Symbol {
+        int32_t deltaFindState;
+        uint32_t deltaNbBits;
+    };
+    int tableLog;
+    Symbol symbols[256];
+    uint16_t stateTable[1 << ANS_TABLE_LOG];
+};
+
+void buildAnsEncoder(int tableLog, const uint16_t norm[256], AnsEncoder& enc) {
+    uint8_t spread[1 << ANS_TABLE_LOG];
+    spreadSymbols(tableLog, norm, spread);
+    const unsigned L = 1u << tableLog;
+    unsigned next[256];
+    for (unsigned s = 0, cumul = 0; s < 256; cumul += norm[s], ++s) {
+        next[s] = cumul;
+        if (!norm[s]) continue;
+        unsigned maxBitsOut = tableLog - (norm[s] > 1 ? bit_width(norm[s] - 1u) - 1 : 0);
+        enc.symbols[s] = { int32_t(cumul) - int32_t(norm[s]), (maxBitsOut << 16) - (unsigned(norm[s]) << maxBitsOut) };
+    }
+    for (unsigned u = 0; u < L; ++u) enc.stateTable[next[spread[u]]++] = uint16_t(L + u);
+    enc.tableLog = tableLog;
+}
+
+// Дописывает в out поток tANS для n >= 1 символов.
+void encodeAnsStream(const uint8_t* data, size_t n, const AnsEncoder& enc, string& out) {
+    const unsigned L = 1u << enc.tableLog;
+    size_t start = out.size();
+    out.resize(start + (n + 2) * enc.tableLog / 8 + 2 + 8);
+    uint8_t* p = reinterpret_cast<uint8_t*>(&out[start]);
+    uint64_t acc = 0;
+    unsigned count = 0;
+    uint32_t x0 = L, x1 = L;
+    auto put = [&](uint32_t& x, uint8_t s) {
+        const AnsEncoder::Symbol& t = enc.symbols[s];
+        unsigned nb = (x + t.deltaNbBits) >> 16;
+        acc |= uint64_t(x & ((1u << nb) - 1)) << count;
+        count += nb;
+        x = enc.stateTable[int32_t(x >> nb) + t.deltaFindState];
+    };
+    // После сброса в накопителе не больше 7 бит, так что четыре символа по tableLog бит помещаются.
+    auto flush = [&] {
+        storeLE64(p, acc);
+        p += count >> 3;
+        acc >>= count & ~7u;
+        count &= 7;
+    };
+
+    size_t i = n;
+    while (i % 4) {
+        --i;
+        put(i & 1 ? x1 : x0, data[i]);
+        flush();
+    }
+    while (i > 0) {
+        i -= 4;
+        put(x1, data[i + 3]);
+        put(x0, data[i + 2]);
+        put(x1, data[i + 1]);
+        put(x0, data[i]);
+        flush();
+    }
+    acc |= uint64_t(x1 - L) << count;
+    count += enc.tableLog;
+    acc |= uint64_t(x0 - L) << count;
+    count += enc.tableLog;
+    acc |= uint64_t(1) << count++;
+    flush();
+    out.resize(size_t(p - reinterpret_cast<uint8_t*>(&out[start])) + (count > 0) + start);
+}
+
+// Состояние декодера — позиция u в [0, L): символ, сколько бит дочитать и с чего начинается следующее.
+struct AnsDecodeEntry {
+    uint16_t newState;
+    uint8_t symbol;
+    uint8_t nbBits;
+};
+
+struct AnsDecoder {
+    int tableLog;
+    AnsDecodeEntry table[1 << ANS_TABLE_LOG];
+};
+
+void buildAnsDecoder(int tableLog, const uint16_t norm[256], AnsDecoder& dec) {
+    uint8_t spread[1 << ANS_TABLE_LOG];
+    spreadSymbols(tableLog, norm, spread);
+    const unsigned L = 1u << tableLog;
+    unsigned next[256];
+    for (int s = 0; s < 256; ++s) next[s] = norm[s];
+    for (unsigned u = 0; u < L; ++u) {
+        uint8_t s = spread[u];
+        unsigned x = next[s]++;
+        unsigned nb = tableLog - (bit_width(x) - 1);
+        dec.table[u] = { uint16_t((x << nb) - L), s, uint8_t(nb) };
+    }
+    dec.tableLog = tableLog;
+}
+
+// Чтение потока с конца: bits — 64 бита начиная с ptr, consumed — сколько старших из них прочитано.
+struct ReverseBitReader {
+    const uint8_t* start;
+    const uint8_t* ptr;
+    uint64_t bits;
+    unsigned consumed;
+};
+
+static bool initReverseReader(ReverseBitReader& r, const uint8_t* data, size_t size) {
+    if (size == 0 || data[size - 1] == 0) return false;
+    r.start = data;
+    if (size >= 8) {
+        r.ptr = data + size - 8;
+        r.bits = loadLE64(r.ptr);
+        r.consumed = 0;
+    }
+    else {
+        r.ptr = data;
+        r.bits = 0;
+        for (size_t i = 0; i < size; ++i) r.bits |= uint64_t(data[i]) << (8 * i);
+        r.consumed = unsigned(8 * (8 - size));  // недостающие байты — нули над потоком
+    }
+    r.consumed += unsigned(countl_zero(data[size - 1])) + 1;  // нули над меткой и сама метка
+    return true;
+}
+
+static inline uint32_t readBitsReverse(ReverseBitReader& r, unsigned nb) {
+    uint64_t v = (r.bits << (r.consumed & 63)) >> 1 >> (63 - nb);
+    r.consumed += nb;
+    return uint32_t(v);
+}
+
+// Сдвигает окно к началу потока, чтобы непрочитанные биты оказались сверху.
+static inline void reloadReverse(ReverseBitReader& r) {
+    size_t back = min<size_t>(r.consumed >> 3, size_t(r.ptr - r.start));
+    if (back == 0) return;
+    r.ptr -= back;
+    r.consumed -= unsigned(8 * back);
+    r.bits = loadLE64(r.ptr);
+}
+
+// Декодирует ровно n символов; поток должен быть прочитан до последнего бита.
+bool decodeAnsStream(const AnsDecoder& dec, const uint8_t* data, size_t size, char* out, size_t n) {
+    ReverseBitReader r;
+    if (!initReverseReader(r, data, size) || r.consumed + 2 * dec.tableLog > 64) return false;
+    uint32_t x0 = readBitsReverse(r, dec.tableLog);
+    uint32_t x1 = readBitsReverse(r, dec.tableLog);
+    auto step = [&](uint32_t& x, size_t i) {
+        AnsDecodeEntry e = dec.table[x];
+        out[i] = char(e.symbol);
+        x = e.newState + readBitsReverse(r, e.nbBits);
+    };
+
+    // Пока до начала потока не меньше 8 байт, после подгрузки прочитано не больше 7 бит окна
+    // и четыре символа укладываются в него без проверок.
+    size_t i = 0;
+    for (; i + 4 <= n && r.ptr >= r.start + 8; i += 4) {
+        reloadReverse(r);
+        step(x0, i);
+        step(x1, i + 1);
+        step(x0, i + 2);
+        step(x1, i + 3);
+    }
+    for (; i < n; ++i) {
+        reloadReverse(r);
+        uint32_t& x = i & 1 ? x1 : x0;
+        if (r.consumed + dec.table[x].nbBits > 64) return false;
+        step(x, i);
+    }
+    reloadReverse(r);
+    return r.ptr == r.start && r.consumed == 64;
+}
+
+bool encodeAnsBody(const uint8_t* data, size_t n, const size_t freq[256], string& out) {
+    uint16_t norm[256];
+    thread_local AnsEncoder enc;
+    // у пустого входа частот нет, а декодеру нужна таблица — берётся таблица из одного символа
+    const size_t single[256] = { 1 };
+    {
+        StageTimer timer(STAGE_BUILD);
+        if (!normalizeFrequencies(n ? freq : single, ANS_TABLE_LOG, norm)) return false;
+        buildAnsEncoder(ANS_TABLE_LOG, norm, enc);
+    }
+    writeAnsTable(out, ANS_TABLE_LOG, norm);
+    encodeAnsStream(data, n, enc, out);
+    return true;
+}
+
+bool decodeAnsBody(const uint8_t* p, const uint8_t* end, char* out, size_t len) {
+    int tableLog;
+    uint16_t norm[256];
+    if (!readAnsTable(p, end, tableLog, norm)) return false;
+    thread_local AnsDecoder dec;
+    {
+        StageTimer timer(STAGE_BUILD);
+        buildAnsDecoder(tableLog, norm, dec);
+    }
+    return decodeAnsStream(dec, p, size_t(end - p), out, len);
+}
+
+// ===================== LZ77 =====================
+// Поиск повторов перед энтропийным кодом, как в deflate: блок разбивается на последовательности
+// «серия литералов, затем совпадение (длина, расстояние)». Литералы и коды трёх величин идут
+// отдельными потоками, и каждый сжимается своим префиксным кодом по байтовому алфавиту тем же
+// построителем длин, что и без LZ77; младшие биты величин пишутся отдельным потоком как есть.
+// Окно — 1 МБ внутри блока, блоки остаются независимыми. Совпадения ищутся по хеш-цепочкам.
+// Тело MODEL_LZ: число литералов u32, число последовательностей u32, затем пять потоков, каждый
+// с размером u32: литералы, коды длин серий литералов, коды длин совпадений, коды расстояний
+// (таблица длин и биты) и дополнительные биты.
+const int LZ_MIN_MATCH = 4;
+const int LZ_WINDOW_LOG = 20;
+const int LZ_HASH_LOG = 16;
+const int LZ_MAX_LEVEL = 9;
+const int LZ_MAX_CODE = 127;  // код величины вплоть до 2^32 - 1
+
+// Уровень: сколько кандидатов цепочки проверять, какое совпадение считать достаточным и нужен ли
+// ленивый разбор (совпадение откладывается, если со следующего байта есть длиннее); с ленивым
+// разбором в цепочки попадают и позиции внутри совпадений.
+struct LzLevel {
+    int chain;
+    size_t nice;
+    bool lazy;
+};
+
+const LzLevel LZ_LEVELS[LZ_MAX_LEVEL + 1] = {
+    { 0, 0, false },       { 1, 16, false },     { 4, 32, false },       { 8, 64, false },
+    { 16, 64, true },      { 32, 128, true },    { 64, 128, true },      { 128, 256, true },
+    { 256, 512, true },    { 1024, 1024, true },
+};
+
+struct LzSequence {
+    uint32_t literals;
+    uint32_t length;
+    uint32_t distance;
+};
+
+// Величина в код байтового алфавита: до 15 — сама величина, дальше по четыре кода на степень
+// двойки (два бита после старшей единицы) и extraBits младших бит отдельно.
+static inline uint8_t lzCode(uint32_t v, int& extraBits) {
+    if (v < 16) {
+        extraBits = 0;
+        return uint8_t(v);
+    }
+    int h = bit_width(v) - 1;
+    extraBits = h - 2;
+    return uint8_t(16 + (h - 4) * 4 + ((v >> (h - 2)) & 3));
+}
+
+static inline uint32_t lzCodeBase(uint8_t code, int& extraBits) {
+    if (code < 16) {
+        extraBits = 0;
+        return code;
+    }
+    int h = (code - 16) / 4 + 4;
+    extraBits = h - 2;
+    return uint32_t(4 | ((code - 16) & 3)) << (h - 2);
+}
+
+static inline size_t matchLength(const uint8_t* a, const uint8_t* b, const uint8_t* end) {
+    const uint8_t* start = b;
+    for (; b + 8 <= end; a += 8, b += 8) {
+        uint64_t x = loadLE64(a) ^ loadLE64(b);
+        if (x) return size_t(b - start) + (countr_zero(x) >> 3);
+    }
+    while (b < end && *a == *b) ++a, ++b;
+    return size_t(b - start);
+}
+
+// Разбор блока на последовательности; литералы после последнего совпадения в них не входят.
+void findSequences(const uint8_t* data, size_t n, int level, vector<LzSequence>& seqs) {
+    StageTimer timer(STAGE_MATCH);
+    const LzLevel& cfg = LZ_LEVELS[level];
+    const size_t window = size_t(1) << LZ_WINDOW_LOG;
+    // Позиции хранятся со сдвигом на 1, 0 — пусто. prev не очищается: цепочка идёт только
+    // к меньшим позициям и обрывается за окном, так что старые записи не читаются.
+    thread_local vector<uint32_t> head, prev;
+    head.assign(size_t(1) << LZ_HASH_LOG, 0);
+    prev.resize(window);
+    seqs.clear();
+    auto hash = [&](size_t i) {
+        uint32_t v;
+        memcpy(&v, data + i, 4);
+        return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+    };
+    auto insert = [&](size_t i) {
+        uint32_t& h = head[hash(i)];
+        prev[i & (window - 1)] = h;
+        h = uint32_t(i + 1);
+    };
+    auto find = [&](size_t i, size_t& bestLen, size_t& bestDist) {
+        bestLen = 0;
+        uint32_t cand = head[hash(i)];
+        for (int chain = cfg.chain; cand && chain > 0; --chain) {
+            size_t c = cand - 1;
+            if (i - c > window) break;
+            if (data[c + bestLen] == data[i + bestLen]) {
+                size_t len = matchLength(data + c, data + i, data + n);
+                if (len > bestLen) {
+                    bestLen = len;
+                    bestDist = i - c;
+                    if (len >= cfg.nice || i + len == n) break;
+                }
+            }
+            uint32_t next = prev[c & (window - 1)];
+            if (next >= cand) break;
+            cand = next;
+        }
+        if (bestLen < size_t(LZ_MIN_MATCH)) bestLen = 0;
+    };
+
+    size_t i = 0, anchor = 0;
+    while (i + LZ_MIN_MATCH <= n) {
+        size_t len, dist;
+        find(i, len, dist);
+        insert(i);
+        if (!len) {
+            ++i;
+            continue;
+        }
+        while (cfg.lazy && len < cfg.nice && i + 1 + LZ_MIN_MATCH <= n) {
+            size_t len2, dist2;
+            find(i + 1, len2, dist2);
+            if (len2 <= len) break;
+            insert(++i);
+            len = len2;
+            dist = dist2;
+        }
+        seqs.push_back({ uint32_t(i - anchor), uint32_t(len), uint32_t(dist) });
+        size_t end = i + len;
+        if (cfg.lazy)
+            for (size_t j = i + 1; j < end && j + LZ_MIN_MATCH <= n; ++j) insert(j);
+        i = anchor = end;
+    }
+}
+
+// Поток байтов своим префиксным кодом: размер u32, таблица длин, биты; пустой поток — один размер.
+bool putCodedStream(const uint8_t* data, size_t n, LengthBuilder build, string& out) {
+    size_t at = out.size();
+    putLE(out, 0, 4);
+    if (n) {
+        size_t freq[256];
+        {
+            StageTimer timer(STAGE_COUNT);
+            byteHistogram(data, n, freq);
+        }
+        uint8_t lengths[256];
+        CodeEntry table[256];
+        {
+            StageTimer timer(STAGE_BUILD);
+            if (!build(freq, lengths)) return false;
+            noteCodeLengths(lengths);
+            canonicalCodes(lengths, table);
+        }
+        writeCodeLengths(out, lengths);
+        encodeBits(data, n, table, encodedBitCount(freq, table), out);
+    }
+    uint64_t size = out.size() - at - 4;
+    for (int i = 0; i < 4; ++i) out[at + i] = char((size >> (8 * i)) & 0xFF);
+    return true;
+}
+
+// Тело MODEL_LZ в out (с начала); false, если блок слишком велик для 32-битных позиций.
+bool encodeLzBody(const uint8_t* data, size_t n, int level, LengthBuilder build, string& out) {
+    if (level < 1 || level > LZ_MAX_LEVEL || n >= (uint64_t(1) << 32)) return false;
+    thread_local vector<LzSequence> seqs;
+    thread_local vector<uint8_t> literals, litCodes, lenCodes, distCodes;
+    findSequences(data, n, level, seqs);
+    literals.clear();
+    litCodes.resize(seqs.size());
+    lenCodes.resize(seqs.size());
+    distCodes.resize(seqs.size());
+
+    uint64_t extraTotal = 0;
+    size_t pos = 0;
+    for (size_t k = 0; k < seqs.size(); ++k) {
+        const LzSequence& q = seqs[k];
+        literals.insert(literals.end(), data + pos, data + pos + q.literals);
+        pos += q.literals + q.length;
+        int a, b, c;
+        litCodes[k] = lzCode(q.literals, a);
+        lenCodes[k] = lzCode(q.length - LZ_MIN_MATCH, b);
+        distCodes[k] = lzCode(q.distance - 1, c);
+        extraTotal += a + b + c;
+    }
+    literals.insert(literals.end(), data + pos, data + n);
+
+    out.clear();
+    putLE(out, literals.size(), 4);
+    putLE(out, seqs.size(), 4);
+    if (!putCodedStream(literals.data(), literals.size(), build, out) ||
+        !putCodedStream(litCodes.data(), seqs.size(), build, out) ||
+        !putCodedStream(lenCodes.data(), seqs.size(), build, out) ||
+        !putCodedStream(distCodes.data(), seqs.size(), build, out))
+        return false;
+
+    size_t extraBytes = size_t((extraTotal + 7) / 8);
+    putLE(out, extraBytes, 4);
+    size_t start = out.size();
+    out.resize(start + extraBytes + 4);
+    BitWriter w = { reinterpret_cast<uint8_t*>(&out[start]), 0, 0 };
+    for (const LzSequence& q : seqs) {
+        int bits;
+        lzCode(q.literals, bits);
+        putBits(w, q.literals & ((uint64_t(1) << bits) - 1), bits);
+        lzCode(q.length - LZ_MIN_MATCH, bits);
+        putBits(w, (q.length - LZ_MIN_MATCH) & ((uint64_t(1) << bits) - 1), bits);
+        lzCode(q.distance - 1, bits);
+        putBits(w, (q.distance - 1) & ((uint64_t(1) << bits) - 1), bits);
+    }
+    flushBits(w);
+    out.resize(start + extraBytes);
+    return true;
+}
+
+// Тело потока или блока: таблица длин (если нет общей sharedTable) и биты либо, если так короче,
+// контекстная модель или (при lzLevel > 0) LZ77; для TANS_CODER — всегда tANS. Байт модели пишется при tagModel или если
+// модель не MODEL_ORDER0; возвращается выбранная модель или -1 при ошибке.
+int encodeBody(const uint8_t* data, size_t n, LengthBuilder build, const CodeEntry* sharedTable, bool tagModel,
+               int lzLevel, string& out) {
+    StageTimer timer(STAGE_ENCODE);
+    size_t freq[256];
+    {
+        StageTimer countTimer(STAGE_COUNT);
+        byteHistogram(data, n, freq);
+    }
+    if (build == TANS_CODER) {
+        out.push_back(char(MODEL_ANS));
+        stageCount(STAT_SYMBOLS, n);
+        return encodeAnsBody(data, n, freq, out) ? MODEL_ANS : -1;
+    }
+    CodeEntry own[256];
+    uint8_t lengths[256];
+    const CodeEntry* table = sharedTable;
+    uint64_t order0Bits = 0;
+    if (!table) {
+        StageTimer buildTimer(STAGE_BUILD);
+        if (!build(freq, lengths)) return -1;
+        noteCodeLengths(lengths);
+        canonicalCodes(lengths, own);
+        table = own;
+        order0Bits += 8 * codeLengthsSize(lengths);
+    }
+    uint64_t payloadBits = encodedBitCount(freq, table);
+    order0Bits += payloadBits;
+
+    thread_local string lzBody;
+    bool lz = lzLevel > 0 && encodeLzBody(data, n, lzLevel, build, lzBody) && 8 * uint64_t(lzBody.size()) < order0Bits;
+    uint64_t bestBits = lz ? 8 * uint64_t(lzBody.size()) : order0Bits;
+    if (n >= CONTEXT_MIN_INPUT) {
+        thread_local ContextCode context;
+        uint64_t contextBits;
+        if (buildContextCode(data, n, build, bestBits, context, contextBits)) {
+            out.push_back(char(MODEL_CONTEXT));
+            encodeContextBits(data, n, context, out);
+            stageCount(STAT_SYMBOLS, n);
+            return MODEL_CONTEXT;
+        }
+    }
+    if (lz) {
+        out.push_back(char(MODEL_LZ));
+        out += lzBody;
+        // литералы и по три кода на последовательность (см. encodeLzBody)
+        const uint8_t* counts = reinterpret_cast<const uint8_t*>(lzBody.data());
+        stageCount(STAT_SYMBOLS, getLE(counts, 4) + 3 * getLE(counts + 4, 4));
+        return MODEL_LZ;
+    }
+    if (tagModel) out.push_back(char(MODEL_ORDER0));
+    if (!sharedTable) writeCodeLengths(out, lengths);
+    encodeBits(data, n, table, payloadBits, out);
+    stageCount(STAT_SYMBOLS, n);
+    return MODEL_ORDER0;
+}
+
+// Архив пишется в archive с начала; ёмкость буфера сохраняется между вызовами. Со словарём
+// dictionary тело кодируется его кодом, а вместо таблицы длин пишется id словаря.
+bool buildSingleArchive(const string& magic, const uint8_t* data, size_t n, LengthBuilder build, int lzLevel,
+                        string& archive, const Dictionary* dictionary = nullptr) {
+    archive.assign(magic);
+    archive.push_back(0);
+    putLE(archive, n, 8);
+    putLE(archive, crc32(data, n), 4);
+    if (dictionary) putLE(archive, dictionary->id, 4);
+    int model = encodeBody(data, n, build, dictionary ? dictionary->codes : nullptr, false, lzLevel, archive);
+    if (model < 0) return false;
+    archive[4] = char((model != MODEL_ORDER0 ? FLAG_MODEL : 0) | (dictionary ? FLAG_DICTIONARY : 0));
+    return true;
+}
+
+string buildSingleArchive(const string& magic, const uint8_t* data, size_t n, LengthBuilder build, int lzLevel = 0) {
+    string archive;
+    return buildSingleArchive(magic, data, n, build, lzLevel, archive) ? archive : "";
+}
+
+// Блок: длина u32, размер тела u32, CRC32 u32, тело с байтом модели (блочные архивы пишутся с FLAG_MODEL).
+bool encodeBlock(const uint8_t* data, size_t len, LengthBuilder build, const CodeEntry* sharedTable, int lzLevel,
+                 string& block) {
+    block.clear();
+    putLE(block, len, 4);
+    putLE(block, 0, 4);
+    putLE(block, crc32(data, len), 4);
+    if (encodeBody(data, len, build, sharedTable, true, lzLevel, block) < 0) return false;
+    uint64_t bodySize = block.size() - BLOCK_HEADER_SIZE;
+    for (int i = 0; i < 4; ++i) block[4 + i] = char((bodySize >> (8 * i)) & 0xFF);
+    return true;
+}
 
-        int blockSize = findOptimalBlockSize(readFile(inputFile));
-        cout << "Оптимальная длина блока: " << blockSize << endl;
+// Общая таблица берётся, если с ней архив выходит меньше, чем с отдельной таблицей у каждого блока.
+bool preferSharedTable(const vector<array<size_t, 256>>& freqs, LengthBuilder build, uint8_t shared[256]) {
+    StageTimer timer(STAGE_BUILD);
+    size_t total[256] = {};
+    for (auto& f : freqs)
+        for (int i = 0; i < 256; ++i) total[i] += f[i];
+    if (!build(total, shared)) return false;
+    CodeEntry sharedTable[256];
+    canonicalCodes(shared, sharedTable);
+
+    uint64_t ownBits = 0, sharedBits = 8 * codeLengthsSize(shared);
+    for (auto& f : freqs) {
+        uint8_t lengths[256];
+        CodeEntry table[256];
+        if (!build(f.data(), lengths)) return false;
+        canonicalCodes(lengths, table);
+        ownBits += 8 * codeLengthsSize(lengths) + encodedBitCount(f.data(), table) + 7;
+        sharedBits += encodedBitCount(f.data(), sharedTable) + 7;
+    }
+    return sharedBits < ownBits;
+}
+
+bool tableFromLengths(const uint8_t lengths[256], DecodeTable& table, bool multiSymbol = true) {
+    StageTimer timer(STAGE_BUILD);
+    noteCodeLengths(lengths);
+    CodeEntry canonical[256];
+    canonicalCodes(lengths, canonical);
+    vector<PrefixCode> codes;
+    for (int i = 0; i < 256; ++i)
+        if (lengths[i]) codes.push_back({ static_cast<unsigned char>(i), canonical[i].code, lengths[i] });
+    return buildDecodeTable(codes, table, multiSymbol);
+}
+
+bool readContextTables(const uint8_t*& p, const uint8_t* end, vector<DecodeTable>& tables) {
+    if (end - p < 32) return false;
+    const uint8_t* used = p;
+    p += 32;
+    tables.assign(256, DecodeTable{ {}, 0 });
+    for (int c = 0; c < 256; ++c) {
+        if (!(used[c >> 3] & (1 << (c & 7)))) continue;
+        uint8_t lengths[256];
+        if (!readCodeLengths(p, end, lengths) || !tableFromLengths(lengths, tables[c], false)) return false;
+    }
+    return true;
+}
+
+// Символы по одному: таблица каждого следующего выбирается по только что декодированному.
+size_t decodeContextInto(const vector<DecodeTable>& tables, const uint8_t* data, size_t size,
+                         uint64_t totalBits, char* out, size_t maxSymbols) {
+    totalBits = min<uint64_t>(totalBits, uint64_t(size) * 8);
+    size_t produced = 0;
+    uint64_t pos = 0;
+    uint8_t prev = 0;
+    while (produced < maxSymbols) {
+        const DecodeTable& table = tables[prev];
+        if (table.minLen == 0) break;
+        int consumed;
+        const DecodeEntry* e = lookupEntry(table, data, size, pos, consumed);
+        if (!e || pos + consumed + e->firstBits > totalBits) break;
+        prev = uint8_t(e->syms & 0xFF);
+        out[produced++] = char(prev);
+        pos += consumed + e->firstBits;
+    }
+    return produced;
+}
+
+bool getCodedStream(const uint8_t*& p, const uint8_t* end, size_t count, char* out) {
+    if (end - p < 4) return false;
+    uint64_t size = getLE(p, 4);
+    p += 4;
+    if (size > uint64_t(end - p)) return false;
+    const uint8_t* q = p;
+    p += size;
+    if (count == 0) return size == 0;
+    uint8_t lengths[256];
+    DecodeTable table;
+    if (!readCodeLengths(q, p, lengths) || !tableFromLengths(lengths, table)) return false;
+    return decodeInto(table, q, size_t(p - q), uint64_t(p - q) * 8, out, count) == count;
+}
+
+// Копия совпадения; при расстоянии меньше 8 источник перекрывается с приёмником и копируется по байту.
+static inline void copyMatch(char* dst, size_t dist, size_t len) {
+    const char* src = dst - dist;
+    size_t k = 0;
+    if (dist >= 8)
+        for (; k + 8 <= len; k += 8) memcpy(dst + k, src + k, 8);
+    for (; k < len; ++k) dst[k] = src[k];
+}
+
+bool decodeLzBody(const uint8_t* p, const uint8_t* end, char* out, size_t len) {
+    if (end - p < 8) return false;
+    size_t literalCount = size_t(getLE(p, 4)), seqCount = size_t(getLE(p + 4, 4));
+    p += 8;
+    if (literalCount > len || seqCount > len / LZ_MIN_MATCH) return false;
+    stageCount(STAT_SYMBOLS, literalCount + 3 * seqCount);
+    thread_local string literals, litCodes, lenCodes, distCodes;
+    literals.resize(literalCount);
+    litCodes.resize(seqCount);
+    lenCodes.resize(seqCount);
+    distCodes.resize(seqCount);
+    if (!getCodedStream(p, end, literalCount, literals.data()) || !getCodedStream(p, end, seqCount, litCodes.data()) ||
+        !getCodedStream(p, end, seqCount, lenCodes.data()) || !getCodedStream(p, end, seqCount, distCodes.data()) ||
+        end - p < 4 || getLE(p, 4) != uint64_t(end - p - 4))
+        return false;
+    const uint8_t* extra = p + 4;
+    size_t extraSize = size_t(end - extra);
+    uint64_t bitPos = 0;
+    auto value = [&](char code, uint64_t& v) {
+        if (uint8_t(code) > LZ_MAX_CODE) return false;
+        int bits;
+        v = lzCodeBase(uint8_t(code), bits);
+        if (bits == 0) return true;
+        if (bitPos + bits > uint64_t(extraSize) * 8) return false;
+        v += peekBits(extra, extraSize, bitPos) >> (64 - bits);
+        bitPos += bits;
+        return true;
+    };
+
+    size_t o = 0, l = 0;
+    for (size_t k = 0; k < seqCount; ++k) {
+        uint64_t run, matchLen, dist;
+        if (!value(litCodes[k], run) || !value(lenCodes[k], matchLen) || !value(distCodes[k], dist)) return false;
+        matchLen += LZ_MIN_MATCH;
+        dist += 1;
+        if (run > literalCount - l || run > len - o) return false;
+        memcpy(out + o, literals.data() + l, size_t(run));
+        o += size_t(run);
+        l += size_t(run);
+        if (dist > o || matchLen > len - o) return false;
+        copyMatch(out + o, size_t(dist), size_t(matchLen));
+        o += size_t(matchLen);
+    }
+    if (literalCount - l != len - o) return false;
+    memcpy(out + o, literals.data() + l, len - o);
+    return true;
+}
+
+// Тело потока или блока (см. encodeBody): таблицы по байту модели и биты ровно на len символов.
+bool decodeBody(const uint8_t* p, const uint8_t* end, uint8_t flags, const DecodeTable* sharedTable,
+                char* out, size_t len) {
+    StageTimer timer(STAGE_DECODE);
+    uint8_t model = MODEL_ORDER0;
+    if (flags & FLAG_MODEL) {
+        if (p >= end) return false;
+        model = *p++;
+    }
+    if (model != MODEL_LZ) stageCount(STAT_SYMBOLS, len);
+    if (model == MODEL_ANS) return decodeAnsBody(p, end, out, len);
+    if (model == MODEL_LZ) return decodeLzBody(p, end, out, len);
+    if (model == MODEL_CONTEXT) {
+        vector<DecodeTable> tables;
+        if (!readContextTables(p, end, tables)) return false;
+        size_t payloadSize = size_t(end - p);
+        return decodeContextInto(tables, p, payloadSize, uint64_t(payloadSize) * 8, out, len) == len;
+    }
+    if (model != MODEL_ORDER0) return false;
+    DecodeTable own;
+    const DecodeTable* table = sharedTable;
+    if (!table) {
+        uint8_t lengths[256];
+        if (!readCodeLengths(p, end, lengths) || !tableFromLengths(lengths, own)) return false;
+        table = &own;
+    }
+    size_t payloadSize = size_t(end - p);
+    return decodeInto(*table, p, payloadSize, uint64_t(payloadSize) * 8, out, len) == len;
+}
+
+// Старый формат (HUFF/SFAN): поток стоит сразу за сигнатурой, дальше словарь и упакованные биты.
+bool decodeLegacyStream(istream& in, string& decoded) {
+    vector<PrefixCode> codes;
+    DecodeTable table;
+    if (!readLegacyDictionary(in, codes) || !buildDecodeTable(codes, table)) return false;
+    vector<uint8_t> payload((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    decodeBits(table, payload.data(), payload.size(), uint64_t(payload.size()) * 8, SIZE_MAX, decoded);
+    return true;
+}
+
+// Начало тела архива из одного потока: за заголовком, а при FLAG_DICTIONARY — и за id словаря.
+static size_t singleBodyOffset(uint8_t flags) {
+    return CONTAINER_HEADER_SIZE + (flags & FLAG_DICTIONARY ? 4 : 0);
+}
+
+// Заголовок архива из одного потока: в rawLen — длина исходных данных, если она возможна при таком теле.
+bool singleArchiveLength(const uint8_t* p, const uint8_t* end, uint64_t& rawLen) {
+    if (size_t(end - p) < CONTAINER_HEADER_SIZE || (p[4] & ~(FLAG_MODEL | FLAG_DICTIONARY)) != 0) return false;
+    uint8_t flags = p[4];
+    if (size_t(end - p) < singleBodyOffset(flags)) return false;
+    rawLen = getLE(p + 5, 8);
+    p += singleBodyOffset(flags);
+    // Префиксный код тратит на символ хотя бы бит; в tANS и с LZ77 символ может не стоить ни одного.
+    bool unbounded = (flags & FLAG_MODEL) && p < end && (*p == MODEL_ANS || *p == MODEL_LZ);
+    return unbounded || rawLen <= uint64_t(end - p) * 8;
+}
+
+// Распаковка в out длиной ровно singleArchiveLength байт. Архив со словарём читается только с тем
+// же словарём dictionary.
+bool decodeSingleInto(const uint8_t* p, const uint8_t* end, char* out, size_t len,
+                      const Dictionary* dictionary = nullptr) {
+    uint8_t flags = p[4];
+    uint32_t crc = uint32_t(getLE(p + 13, 4));
+    const DecodeTable* table = nullptr;
+    if (flags & FLAG_DICTIONARY) {
+        if (!dictionary || getLE(p + CONTAINER_HEADER_SIZE, 4) != dictionary->id) return false;
+        table = &dictionary->decode;
+    }
+    return decodeBody(p + singleBodyOffset(flags), end, flags, table, out, len) &&
+           crc32(reinterpret_cast<const uint8_t*>(out), len) == crc;
+}
+
+bool decodeSingle(const uint8_t* p, const uint8_t* end, string& decoded, const Dictionary* dictionary = nullptr) {
+    uint64_t rawLen;
+    if (!singleArchiveLength(p, end, rawLen)) return false;
+    decoded.resize(size_t(rawLen));
+    return decodeSingleInto(p, end, &decoded[0], decoded.size(), dictionary);
+}
+
+// Тело блока сверяется с CRC32 блока.
+bool decodeBlockBody(const uint8_t* body, const uint8_t* bodyEnd, uint8_t flags, const DecodeTable& sharedTable,
+                     char* out, size_t len, uint32_t crc) {
+    return decodeBody(body, bodyEnd, flags, flags & FLAG_SHARED_TABLE ? &sharedTable : nullptr, out, len) &&
+           crc32(reinterpret_cast<const uint8_t*>(out), len) == crc;
+}
+
+// Разобранный индекс блочного архива, лежащего в памяти целиком.
+struct BlockIndex {
+    uint8_t flags;
+    DecodeTable sharedTable;
+    const Dictionary* dictionary = nullptr;  // общая таблица — код словаря (FLAG_DICTIONARY)
+    vector<const uint8_t*> blocks;
+    vector<uint64_t> outOffsets;  // начало каждого блока в распакованных данных, последний — общая длина
+};
+
+// Индекс в конце блочного архива: возвращает его начало (или nullptr), число блоков и общую длину.
+const uint8_t* findBlockIndex(const uint8_t* begin, const uint8_t* end, uint64_t& blockCount, uint64_t& rawLen) {
+    size_t size = size_t(end - begin);
+    if (size < 5 + 4 + 4 + 8 + 4) return nullptr;
+    uint64_t indexSize = getLE(end - 4, 4);
+    if (indexSize < 4 + 8 + 4 || indexSize > size - 5) return nullptr;
+    const uint8_t* index = end - indexSize;
+    blockCount = getLE(index, 4);
+    if (indexSize != 4 + 8 * blockCount + 8 + 4) return nullptr;
+    rawLen = getLE(index + 4 + 8 * blockCount, 8);
+    return index;
+}
+
+bool parseBlockIndex(const uint8_t* begin, const uint8_t* end, BlockIndex& idx,
+                     const Dictionary* dictionary = nullptr) {
+    uint64_t blockCount, rawLen;
+    const uint8_t* index = findBlockIndex(begin, end, blockCount, rawLen);
+    if (!index) return false;
+    idx.flags = begin[4];
+    idx.dictionary = nullptr;
+
+    uint8_t shared[256];
+    const uint8_t* p = begin + 5;
+    if (idx.flags & FLAG_DICTIONARY) {
+        if (!(idx.flags & FLAG_SHARED_TABLE) || index - p < 4 || !dictionary || getLE(p, 4) != dictionary->id)
+            return false;
+        idx.dictionary = dictionary;
+        p += 4;
+    }
+    else if ((idx.flags & FLAG_SHARED_TABLE) &&
+             (!readCodeLengths(p, index, shared) || !tableFromLengths(shared, idx.sharedTable)))
+        return false;
+
+    idx.outOffsets.assign(blockCount + 1, 0);
+    idx.blocks.resize(blockCount);
+    for (uint64_t b = 0; b < blockCount; ++b) {
+        uint64_t off = getLE(index + 4 + 8 * b, 8);
+        if (off < uint64_t(p - begin) || off + BLOCK_HEADER_SIZE > uint64_t(index - begin)) return false;
+        idx.blocks[b] = begin + off;
+        uint64_t bodySize = getLE(idx.blocks[b] + 4, 4);
+        if (bodySize > uint64_t(index - idx.blocks[b]) - BLOCK_HEADER_SIZE) return false;
+        idx.outOffsets[b + 1] = idx.outOffsets[b] + getLE(idx.blocks[b], 4);
+    }
+    return idx.outOffsets[blockCount] == rawLen;
+}
+
+bool decodeIndexedBlock(const BlockIndex& idx, size_t b, char* out) {
+    const uint8_t* q = idx.blocks[b];
+    return decodeBlockBody(q + BLOCK_HEADER_SIZE, q + BLOCK_HEADER_SIZE + getLE(q + 4, 4), idx.flags,
+                           idx.dictionary ? idx.dictionary->decode : idx.sharedTable, out, size_t(getLE(q, 4)),
+                           uint32_t(getLE(q + 8, 4)));
+}
+
+// Все блоки idx параллельно в pool прямо в out, где idx.outOffsets.back() байт.
+bool decodeBlocksInto(const BlockIndex& idx, ThreadPool& pool, char* out) {
+    atomic<bool> ok(true);
+    pool.parallelFor(idx.blocks.size(), [&](size_t b) {
+        if (!decodeIndexedBlock(idx, b, out + size_t(idx.outOffsets[b]))) ok = false;
+    });
+    return ok;
+}
+
+// Блоки находятся по индексу в конце файла и распаковываются параллельно прямо в итоговый буфер.
+bool decodeBlocked(const uint8_t* begin, const uint8_t* end, string& decoded, const Dictionary* dictionary = nullptr) {
+    BlockIndex idx;
+    if (!parseBlockIndex(begin, end, idx, dictionary)) return false;
+    decoded.resize(size_t(idx.outOffsets.back()));
+    ThreadPool pool(unsigned(min<size_t>(max(1u, thread::hardware_concurrency()), idx.blocks.size())));
+    return decodeBlocksInto(idx, pool, &decoded[0]);
+}
+
+// Распаковка архива целиком из памяти.
+bool decodeArchiveBytes(span<const uint8_t> archive, const string& magic, string& decoded,
+                        const Dictionary* dictionary = nullptr) {
+    if (archive.size() <= 4 || memcmp(archive.data(), magic.data(), 4) != 0) return false;
+    const uint8_t* p = archive.data();
+    const uint8_t* end = p + archive.size();
+    return p[4] & FLAG_BLOCKS ? decodeBlocked(p, end, decoded, dictionary) : decodeSingle(p, end, decoded, dictionary);
+}
+
+// id словаря, на который ссылается архив magic в памяти; false, если архив без словаря или не этого формата.
+bool archiveDictionaryId(span<const uint8_t> archive, const string& magic, uint32_t& id) {
+    if (archive.size() <= 4 || memcmp(archive.data(), magic.data(), 4) != 0 || !(archive[4] & FLAG_DICTIONARY))
+        return false;
+    size_t at = archive[4] & FLAG_BLOCKS ? 5 : CONTAINER_HEADER_SIZE;
+    if (archive.size() < at + 4) return false;
+    id = uint32_t(getLE(archive.data() + at, 4));
+    return true;
+}
+
+string dictionaryIdText(uint32_t id) {
+    ostringstream text;
+    text << hex << uppercase;
+    text.width(8);
+    text.fill('0');
+    text << id;
+    return text.str();
+}
+
+// Текст id словаря, с которым сжат архив magic, если dictionary не задан или другой; иначе пустая строка.
+string missingDictionaryText(span<const uint8_t> archive, const string& magic, const Dictionary* dictionary) {
+    uint32_t id;
+    if (!archiveDictionaryId(archive, magic, id) || (dictionary && dictionary->id == id)) return "";
+    return dictionaryIdText(id);
+}
+
+// ===================== 流式接口 =====================
+const size_t STREAM_BLOCK_SIZE = 1 << 20;
+const uint64_t MAX_STREAM_BLOCK = uint64_t(1) << 30;
+
+// Для потока неизвестной длины: блоки по 1 МБ на все аппаратные потоки.
+BlockPolicy streamBlockPolicy() {
+    return { STREAM_BLOCK_SIZE, max(1u, thread::hardware_concurrency()) };
+}
+
+// Сжатие с ограниченной памятью: вход копится в пачку из policy.threads блоков, пачка кодируется
+// параллельно и сразу уходит в out. Держится не больше одной пачки входа и её сжатого образа.
+// Без externalPool кодировщик заводит свой пул из policy.threads потоков. Словарь из policy
+// заменяет общую таблицу sharedLengths.
+class StreamEncoder {
+public:
+    StreamEncoder(ostream& out, const string& magic, LengthBuilder build, const BlockPolicy& policy,
+                  const uint8_t* sharedLengths = nullptr, ThreadPool* externalPool = nullptr)
+        : out(out), build(build), policy(policy),
+          ownPool(externalPool ? nullptr : make_unique<ThreadPool>(policy.threads)),
+          pool(externalPool ? *externalPool : *ownPool), shared(sharedLengths || policy.dictionary) {
+        string header = magic;
+        header.push_back(char(FLAG_BLOCKS | FLAG_MODEL | (shared ? FLAG_SHARED_TABLE : 0) |
+                              (policy.dictionary ? FLAG_DICTIONARY : 0)));
+        if (policy.dictionary) {
+            putLE(header, policy.dictionary->id, 4);
+            copy(begin(policy.dictionary->codes), end(policy.dictionary->codes), sharedTable);
+        }
+        else if (shared) {
+            noteCodeLengths(sharedLengths);
+            canonicalCodes(sharedLengths, sharedTable);
+            writeCodeLengths(header, sharedLengths);
+        }
+        write(header);
+    }
+
+    // Полные пачки из data кодируются прямо из памяти вызывающего (например, отображённого файла),
+    // в собственный буфер копируется только неполный остаток.
+    bool feed(span<const uint8_t> data) {
+        size_t capacity = policy.blockSize * policy.threads;
+        while (ok && !data.empty()) {
+            if (batch.empty() && data.size() >= capacity) {
+                encodeBatch(data.first(capacity));
+                data = data.subspan(capacity);
+                continue;
+            }
+            if (batch.capacity() < capacity) batch.reserve(capacity);
+            size_t take = min(capacity - batch.size(), data.size());
+            batch.insert(batch.end(), data.begin(), data.begin() + take);
+            data = data.subspan(take);
+            if (batch.size() == capacity) {
+                encodeBatch(batch);
+                batch.clear();
+            }
+        }
+        return ok;
+    }
+
+    bool finish() {
+        encodeBatch(batch);
+        batch.clear();
+        string tail;
+        putLE(tail, 0, 4);
+        size_t indexStart = tail.size();
+        putLE(tail, offsets.size(), 4);
+        for (uint64_t off : offsets) putLE(tail, off, 8);
+        putLE(tail, total, 8);
+        putLE(tail, tail.size() - indexStart + 4, 4);
+        write(tail);
+        out.flush();
+        return ok && bool(out);
+    }
+
+private:
+    void encodeBatch(span<const uint8_t> data) {
+        if (!ok || data.empty()) return;
+        size_t blockCount = (data.size() + policy.blockSize - 1) / policy.blockSize;
+        blocks.resize(blockCount);
+        atomic<bool> built(true);
+        pool.parallelFor(blockCount, [&](size_t b) {
+            size_t begin = b * policy.blockSize;
+            if (!encodeBlock(data.data() + begin, min(policy.blockSize, data.size() - begin), build,
+                             shared ? sharedTable : nullptr, policy.lzLevel, blocks[b]))
+                built = false;
+        });
+        ok = built;
+        for (size_t b = 0; b < blockCount && ok; ++b) {
+            offsets.push_back(written);
+            write(blocks[b]);
+        }
+        total += data.size();
+    }
+
+    void write(const string& bytes) {
+        StageTimer timer(STAGE_WRITE);
+        out.write(bytes.data(), bytes.size());
+        stageCount(STAT_BYTES_OUT, bytes.size());
+        written += bytes.size();
+        if (!out) ok = false;
+    }
+
+    ostream& out;
+    LengthBuilder build;
+    BlockPolicy policy;
+    unique_ptr<ThreadPool> ownPool;
+    ThreadPool& pool;
+    bool shared;
+    CodeEntry sharedTable[256];
+    vector<uint8_t> batch;
+    vector<string> blocks;
+    vector<uint64_t> offsets;
+    uint64_t written = 0;
+    uint64_t total = 0;
+    bool ok = true;
+};
+
+static bool readExact(istream& in, string& buf, size_t n) {
+    StageTimer timer(STAGE_READ);
+    buf.resize(n);
+    if (n == 0) return true;
+    in.read(&buf[0], n);
+    stageCount(STAT_BYTES_IN, uint64_t(in.gcount()));
+    return bool(in);
+}
+
+bool readCodeLengths(istream& in, uint8_t lengths[256]) {
+    string buf;
+    if (!readExact(in, buf, 33)) return false;
+    int used = 0;
+    for (int i = 1; i <= 32; ++i) used += popcount(static_cast<unsigned char>(buf[i]));
+    size_t rest = static_cast<unsigned char>(buf[0]) <= 15 ? (used + 1) / 2 : used;
+    string tail;
+    if (!readExact(in, tail, rest)) return false;
+    buf += tail;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buf.data());
+    return readCodeLengths(p, p + buf.size(), lengths);
+}
+
+// Распаковка с ограниченной памятью: блоки читаются пачками по числу потоков и декодируются
+// параллельно. Старые архивы и архивы из одного потока (до одного блока) читаются целиком.
+class StreamDecoder {
+public:
+    StreamDecoder(istream& in, const string& magic, const string& legacyMagic, unsigned threads,
+                  const Dictionary* dictionary = nullptr)
+        : in(in), pool(threads), threads(threads) {
+        string header;
+        if (!readExact(in, header, 4)) {
+            error = true;
+            return;
+        }
+        if (header == legacyMagic) {
+            whole = true;
+            error = !decodeLegacyStream(in, pending);
+            return;
+        }
+        string flagByte;
+        if (header != magic || !readExact(in, flagByte, 1)) {
+            error = true;
+            return;
+        }
+        flags = uint8_t(flagByte[0]);
+        if (!(flags & FLAG_BLOCKS)) {
+            whole = true;
+            string archive = header + flagByte;
+            {
+                StageTimer timer(STAGE_READ);
+                archive.append(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+                stageCount(STAT_BYTES_IN, archive.size() - header.size() - flagByte.size());
+            }
+            error = !decodeSingle(reinterpret_cast<const uint8_t*>(archive.data()),
+                                  reinterpret_cast<const uint8_t*>(archive.data()) + archive.size(), pending,
+                                  dictionary);
+            if (error)
+                wantedDictionary = missingDictionaryText(
+                    span<const uint8_t>(reinterpret_cast<const uint8_t*>(archive.data()), archive.size()), magic,
+                    dictionary);
+            return;
+        }
+        uint8_t lengths[256];
+        string id;
+        if (flags & FLAG_DICTIONARY) {
+            if (!(flags & FLAG_SHARED_TABLE) || !readExact(in, id, 4)) error = true;
+            else if (uint32_t wanted = uint32_t(getLE(reinterpret_cast<const uint8_t*>(id.data()), 4));
+                     !dictionary || dictionary->id != wanted) {
+                error = true;
+                wantedDictionary = dictionaryIdText(wanted);
+            }
+            else sharedTable = dictionary->decode;
+        }
+        else if ((flags & FLAG_SHARED_TABLE) &&
+                 (!readCodeLengths(in, lengths) || !tableFromLengths(lengths, sharedTable)))
+            error = true;
+    }
+
+    // Следующий кусок распакованных данных; false — данных больше нет или архив повреждён (см. failed).
+    bool next(string& chunk) {
+        if (error || finished) return false;
+        if (whole) {
+            finished = true;
+            chunk.swap(pending);
+            return true;
+        }
+
+        bodies.resize(threads);
+        vector<uint64_t> rawLens, crcs, outOffsets(1, 0);
+        string header;
+        while (rawLens.size() < threads) {
+            if (!readExact(in, header, 4)) return fail();
+            uint64_t rawLen = getLE(reinterpret_cast<const uint8_t*>(header.data()), 4);
+            if (rawLen == 0) {
+                finished = true;
+                if (!readIndex()) return fail();
+                break;
+            }
+            if (!readExact(in, header, 8)) return fail();
+            uint64_t bodySize = getLE(reinterpret_cast<const uint8_t*>(header.data()), 4);
+            if (rawLen > MAX_STREAM_BLOCK || bodySize > rawLen * MAX_CODE_LEN / 8 + 1024) return fail();
+            if (!readExact(in, bodies[rawLens.size()], size_t(bodySize))) return fail();
+            crcs.push_back(getLE(reinterpret_cast<const uint8_t*>(header.data()) + 4, 4));
+            rawLens.push_back(rawLen);
+            outOffsets.push_back(outOffsets.back() + rawLen);
+            blocksSeen++;
+            total += rawLen;
+        }
+
+        chunk.resize(size_t(outOffsets.back()));
+        atomic<bool> ok(true);
+        pool.parallelFor(rawLens.size(), [&](size_t b) {
+            const uint8_t* body = reinterpret_cast<const uint8_t*>(bodies[b].data());
+            if (!decodeBlockBody(body, body + bodies[b].size(), flags, sharedTable,
+                                 &chunk[size_t(outOffsets[b])], size_t(rawLens[b]), uint32_t(crcs[b])))
+                ok = false;
+        });
+        if (!ok) return fail();
+        return !chunk.empty() || !finished;
+    }
+
+    bool failed() const { return error; }
+
+    // id словаря (dictionaryIdText), без которого архив не распаковать, если его не передали или
+    // передали другой; иначе пустая строка.
+    const string& missingDictionary() const { return wantedDictionary; }
+
+private:
+    bool fail() {
+        error = true;
+        return false;
+    }
+
+    // Индекс в конце сверяется с тем, что пришло: число блоков и общая длина.
+    bool readIndex() {
+        string buf;
+        if (!readExact(in, buf, 4)) return false;
+        uint64_t count = getLE(reinterpret_cast<const uint8_t*>(buf.data()), 4);
+        if (count != blocksSeen || !readExact(in, buf, size_t(8 * count + 8 + 4))) return false;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(buf.data());
+        return getLE(p + 8 * count, 8) == total && getLE(p + 8 * count + 8, 4) == 4 + 8 * count + 8 + 4;
+    }
+
+    istream& in;
+    ThreadPool pool;
+    unsigned threads;
+    uint8_t flags = 0;
+    DecodeTable sharedTable;
+    vector<string> bodies;
+    string pending;
+    bool whole = false;
+    bool finished = false;
+    bool error = false;
+    string wantedDictionary;
+    uint64_t blocksSeen = 0;
+    uint64_t total = 0;
+};
+
+vector<array<size_t, 256>> blockFrequencies(span<const uint8_t> data, const BlockPolicy& policy, ThreadPool& pool) {
+    size_t blockCount = (data.size() + policy.blockSize - 1) / policy.blockSize;
+    vector<array<size_t, 256>> freqs(blockCount);
+    pool.parallelFor(blockCount, [&](size_t b) {
+        size_t begin = b * policy.blockSize;
+        StageTimer timer(STAGE_COUNT);
+        byteHistogram(data.data() + begin, min(policy.blockSize, data.size() - begin), freqs[b].data());
+    });
+    return freqs;
+}
+
+// Частоты блоков и сами блоки считаются в pool, а без него — в одном пуле из policy.threads потоков.
+bool compressBlocked(span<const uint8_t> data, ostream& out, const string& magic,
+                     LengthBuilder build, const BlockPolicy& policy, ThreadPool* pool = nullptr) {
+    unique_ptr<ThreadPool> ownPool;
+    if (!pool) pool = (ownPool = make_unique<ThreadPool>(policy.threads)).get();
+    uint8_t shared[256];
+    bool useShared = build != TANS_CODER && policy.lzLevel == 0 && !policy.dictionary &&
+                     preferSharedTable(blockFrequencies(data, policy, *pool), build, shared);
+    StreamEncoder encoder(out, magic, build, policy, useShared ? shared : nullptr, pool);
+    return encoder.feed(data) && encoder.finish();
+}
+
+string buildBlockedArchive(const string& magic, const uint8_t* data, size_t n,
+                           LengthBuilder build, const BlockPolicy& policy) {
+    ostringstream out;
+    if (!compressBlocked(span<const uint8_t>(data, n), out, magic, build, policy)) return "";
+    return out.str();
+}
+
+string buildArchive(const string& magic, span<const uint8_t> data, LengthBuilder build, const BlockPolicy& policy) {
+    if (policy.blockSize >= data.size())
+        return buildSingleArchive(magic, data.data(), data.size(), build, policy.lzLevel);
+    return buildBlockedArchive(magic, data.data(), data.size(), build, policy);
+}
+
+// Вход, который целиком уместился в первый блок, сжимается в архив из одного потока: для небольших
+// сообщений он короче блочного на заголовок блока и индекс.
+bool compressStream(istream& in, ostream& out, const string& magic, LengthBuilder build,
+                    const BlockPolicy& policy, const uint8_t* sharedLengths = nullptr) {
+    vector<uint8_t> buf(policy.blockSize);
+    auto readBlock = [&] {
+        StageTimer timer(STAGE_READ);
+        in.read(reinterpret_cast<char*>(buf.data()), buf.size());
+        stageCount(STAT_BYTES_IN, uint64_t(in.gcount()));
+        return size_t(in.gcount());
+    };
+    size_t got = readBlock();
+    if (in.eof() && !sharedLengths) {
+        string archive;
+        if (!buildSingleArchive(magic, buf.data(), got, build, policy.lzLevel, archive, policy.dictionary)) return false;
+        writeChunk(out, archive);
+        out.flush();
+        return bool(out);
+    }
+    StreamEncoder encoder(out, magic, build, policy, sharedLengths);
+    while (got > 0) {
+        if (!encoder.feed(span<const uint8_t>(buf.data(), got))) return false;
+        got = in ? readBlock() : 0;
+    }
+    return in.eof() && encoder.finish();
+}
+
+// missingDictionary (если задан) получает id словаря, с которым сжат архив, когда dictionary не задан
+// или другой (см. StreamDecoder::missingDictionary).
+bool decompressStream(istream& in, ostream& out, const string& magic, const string& legacyMagic,
+                      unsigned threads = max(1u, thread::hardware_concurrency()),
+                      const Dictionary* dictionary = nullptr, string* missingDictionary = nullptr) {
+    StreamDecoder decoder(in, magic, legacyMagic, threads, dictionary);
+    string chunk;
+    while (decoder.next(chunk)) writeChunk(out, chunk);
+    out.flush();
+    if (missingDictionary) *missingDictionary = decoder.missingDictionary();
+    return !decoder.failed() && bool(out);
+}
+
+// Сжатие данных из памяти (например, отображённого файла): частоты по блокам считаются прямо
+// по ним, затем StreamEncoder кодирует пачки блоков оттуда же, не копируя вход в свои буферы.
+// archive — буфер для архива из одного потока, pool — пул для блоков (см. compressBlocked).
+bool compressData(span<const uint8_t> data, ostream& out, const string& magic, LengthBuilder build,
+                  const BlockPolicy& policy, string& archive, ThreadPool* pool = nullptr) {
+    stageCount(STAT_BYTES_IN, data.size());
+    if (policy.blockSize >= data.size()) {
+        if (!buildSingleArchive(magic, data.data(), data.size(), build, policy.lzLevel, archive, policy.dictionary))
+            return false;
+        writeChunk(out, archive);
+        return bool(out);
+    }
+    return compressBlocked(data, out, magic, build, policy, pool);
+}
+
+bool compressFile(const string& inputFile, const string& outputFile, const string& magic, LengthBuilder build,
+                  int lzLevel = 0) {
+    if (sameFile(inputFile, outputFile)) {
+        cerr << "Ошибка: выходной файл совпадает с входным!" << endl;
+        return false;
+    }
+    MappedInput in;
+    if (!in.open(inputFile)) {
+        cerr << "Ошибка открытия файла: " << inputFile << endl;
+        return false;
+    }
+    span<const uint8_t> data = in.bytes();
+    if (data.empty()) {
+        cerr << "Ошибка: пустой файл!" << endl;
+        return false;
+    }
+    BlockPolicy policy = chooseBlockPolicy(data.size());
+    policy.lzLevel = lzLevel;
+    cout << "Длина блока: " << policy.blockSize << " байт, потоков: " << policy.threads << endl;
+
+    ofstream out(outputFile, ios::binary);
+    if (!out.is_open()) {
+        cerr << "Ошибка записи файла: " << outputFile << endl;
+        return false;
+    }
+    string archive;
+    return compressData(data, out, magic, build, policy, archive);
+}
+
+// Блочный архив из отображённого файла: пачки по threads блоков по индексу декодируются
+// параллельно прямо из отображения в chunk.
+bool decompressMapped(span<const uint8_t> archive, ostream& out, unsigned threads, string& chunk,
+                      const Dictionary* dictionary = nullptr) {
+    BlockIndex idx;
+    if (!parseBlockIndex(archive.data(), archive.data() + archive.size(), idx, dictionary)) return false;
+    ThreadPool pool(threads);
+    for (size_t first = 0; first < idx.blocks.size(); first += threads) {
+        size_t last = min(idx.blocks.size(), first + threads);
+        chunk.resize(size_t(idx.outOffsets[last] - idx.outOffsets[first]));
+        atomic<bool> ok(true);
+        pool.parallelFor(last - first, [&](size_t i) {
+            size_t b = first + i;
+            if (!decodeIndexedBlock(idx, b, &chunk[size_t(idx.outOffsets[b] - idx.outOffsets[first])])) ok = false;
+        });
+        if (!ok) return false;
+        writeChunk(out, chunk);
+    }
+    out.flush();
+    return bool(out);
+}
+
+// Распаковка отображённого архива inputFile. Архив из одного потока декодируется целиком в chunk,
+// блочный — пачками по threads блоков; старый формат идёт через StreamDecoder.
+bool decompressData(const string& inputFile, span<const uint8_t> archive, ostream& out, const string& magic,
+                    const string& legacyMagic, unsigned threads, string& chunk, const Dictionary* dictionary = nullptr) {
+    if (archive.size() > 4 && memcmp(archive.data(), magic.data(), 4) == 0) {
+        stageCount(STAT_BYTES_IN, archive.size());
+        if (archive[4] & FLAG_BLOCKS) return decompressMapped(archive, out, threads, chunk, dictionary);
+        if (!decodeSingle(archive.data(), archive.data() + archive.size(), chunk, dictionary)) return false;
+        writeChunk(out, chunk);
+        out.flush();
+        return bool(out);
+    }
+    ifstream raw(inputFile, ios::binary);
+    return decompressStream(raw, out, magic, legacyMagic, threads);
+}
+
+bool decompressFile(const string& inputFile, const string& outputFile, const string& magic, const string& legacyMagic) {
+    if (sameFile(inputFile, outputFile)) {
+        cerr << "Ошибка: выходной файл совпадает с входным!" << endl;
+        return false;
+    }
+    MappedInput in;
+    if (!in.open(inputFile)) {
+        cerr << "Ошибка открытия файла!" << endl;
+        return false;
+    }
+    ofstream out(outputFile, ios::binary);
+    if (!out.is_open()) {
+        cerr << "Ошибка записи файла: " << outputFile << endl;
+        return false;
+    }
+    string chunk;
+    bool ok = decompressData(inputFile, in.bytes(), out, magic, legacyMagic, max(1u, thread::hardware_concurrency()), chunk);
+    string wanted = ok ? "" : missingDictionaryText(in.bytes(), magic, nullptr);
+    if (!wanted.empty()) {
+        cerr << "Архив сжат со словарём " << wanted << ": распакуйте его через huffandshf -d -Dсловарь!" << endl;
+        return false;
+    }
+    if (!ok) {
+        cerr << "Архив повреждён или имеет неверный формат!" << endl;
+        return false;
+    }
+    return true;
+}
+
+// ===================== Huffman =====================
+// Длина кода Хаффмана и Шеннона-Фано ограничена: первичная таблица декодера плюс одна подтаблица
+// не шире 4 бит, а таблица длин в заголовке пишется по полбайта.
+const int HUFFMAN_MAX_LEN = 15;
+
+// count[len] — число листьев полного кода на каждой глубине до maxLen. Пара листьев с глубины i
+// уходит на i - 1 (их место занимает один лист), а ближайший лист сверху с глубины j опускается
+// на j + 1 вместе с одним из снятых: сумма Крафта не меняется. Затем длины раздаются символам
+// order[0..n) от редких к частым.
+static void assignLimitedLengths(int count[], int maxLen, const uint16_t order[], int n, uint8_t lengths[256]) {
+    for (int i = maxLen; i > HUFFMAN_MAX_LEN; --i) {
+        while (count[i] > 0) {
+            int j = i - 2;
+            while (count[j] == 0) j--;
+            count[i] -= 2;
+            count[i - 1]++;
+            count[j + 1] += 2;
+            count[j]--;
+        }
+    }
+    for (int len = min(maxLen, HUFFMAN_MAX_LEN), k = 0; len > 0 && k < n; --len)
+        for (int c = 0; c < count[len]; ++c) lengths[order[k++]] = uint8_t(len);
+}
+
+// Символы с ненулевой частотой по возрастанию частоты; при равенстве — по значению байта.
+static int sortByFrequency(const size_t freq[256], uint16_t order[256], uint8_t lengths[256]) {
+    int n = 0;
+    for (int i = 0; i < 256; ++i) {
+        lengths[i] = 0;
+        if (freq[i]) order[n++] = uint16_t(i);
+    }
+    sort(order, order + n, [&](uint16_t x, uint16_t y) { return freq[x] != freq[y] ? freq[x] < freq[y] : x < y; });
+    return n;
+}
+
+// Длины кодов по частотам без дерева и без выделения памяти. Символы сортируются по частоте,
+// затем длины считаются на месте линейным слиянием двух очередей (листья и внутренние узлы)
+// по Моффату и Катайайнену. Слишком длинные коды укорачиваются перестройкой числа кодов каждой
+// длины с сохранением полноты кода, после чего длины раздаются символам от редких к частым.
+bool huffmanLengths(const size_t freq[256], uint8_t lengths[256]) {
+    uint16_t order[256];
+    int n = sortByFrequency(freq, order, lengths);
+    if (n == 0) return true;
+    if (n == 1) {
+        lengths[order[0]] = 1;  // единственный символ получает код из одного бита
+        return true;
+    }
+    uint64_t a[256];
+    for (int i = 1; i < n; ++i) a[i] = freq[order[i]];
+
+    // Слияние: a[next] становится весом внутреннего узла, а вес поглощённого узла — номером родителя.
+    a[0] = freq[order[0]] + freq[order[1]];
+    int root = 0, leaf = 2;
+    for (int next = 1; next < n - 1; ++next) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = uint64_t(next);
+        }
+        else a[next] = a[leaf++];
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = uint64_t(next);
+        }
+        else a[next] += a[leaf++];
+    }
+    // Глубины внутренних узлов от корня, затем число листьев на каждой глубине.
+    a[n - 2] = 0;
+    for (int next = n - 3; next >= 0; --next) a[next] = a[a[next]] + 1;
+    int count[256] = {};
+    int avail = 1, used = 0, depth = 0, maxLen = 0;
+    root = n - 2;
+    while (avail > 0) {
+        while (root >= 0 && a[root] == uint64_t(depth)) {
+            used++;
+            root--;
+        }
+        if (avail > used) {
+            count[depth] += avail - used;
+            maxLen = depth;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+    assignLimitedLengths(count, maxLen, order, n, lengths);
+    return true;
+}
+
+// Канонический код в виде строк из '0'/'1'; нужен только прежним кодекам в сравнении скорости.
+unordered_map<char, string> codesFromLengths(const uint8_t lengths[256]) {
+    CodeEntry table[256];
+    canonicalCodes(lengths, table);
+    unordered_map<char, string> codes;
+    for (int i = 0; i < 256; ++i) {
+        if (!table[i].len) continue;
+        string& code = codes[static_cast<char>(i)];
+        for (int b = table[i].len - 1; b >= 0; --b) code.push_back((table[i].code >> b) & 1 ? '1' : '0');
+    }
+    return codes;
+}
+
+unordered_map<char, string> huffmanCodes(const size_t freq[256]) {
+    uint8_t lengths[256];
+    huffmanLengths(freq, lengths);
+    return codesFromLengths(lengths);
+}
+
+void compressHuffman(const string& inputFile, const string& outputFile, int lzLevel) {
+    auto t0 = chrono::steady_clock::now();
+    if (!compressFile(inputFile, outputFile, "HUF2", huffmanLengths, lzLevel)) return;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cout << "Файл успешно заархивирован (Хаффман): " << outputFile << endl;
+    printCompressionStats(inputFile, outputFile, seconds);
+}
+
+void decompressHuffman(const string& inputFile, const string& outputFile) {
+    if (!decompressFile(inputFile, outputFile, "HUF2", "HUFF")) return;
+    cout << "Файл успешно разархивирован (Хаффман): " << outputFile << endl;
+}
+
+// ===================== Shannon–Fano =====================
+// Отрезок символов, упорядоченных по частоте, делится в точке, где суммы частот половин ближе всего
+// друг к другу (разность |2·левая − вся| сначала убывает, потом растёт), и каждая половина делится
+// дальше; глубина символа в этом делении и есть длина его кода. prefix[i] — сумма первых i частот.
+static void shannonFanoSplit(const uint64_t prefix[], int left, int right, int depth, int depths[]) {
+    if (left == right) {
+        depths[left] = depth;
+        return;
+    }
+    auto imbalance = [&](int split) {
+        int64_t d = 2 * int64_t(prefix[split + 1] - prefix[left]) - int64_t(prefix[right + 1] - prefix[left]);
+        return d < 0 ? -d : d;
+    };
+    int split = left;
+    while (split + 1 < right && imbalance(split + 1) < imbalance(split)) split++;
+    shannonFanoSplit(prefix, left, split, depth + 1, depths);
+    shannonFanoSplit(prefix, split + 1, right, depth + 1, depths);
+}
+
+// Деление даёт полный код, но на сильно неравных частотах глубина доходит до числа символов,
+// поэтому длины ограничиваются так же, как у Хаффмана, и раздаются заново от редких к частым.
+bool shannonFanoLengths(const size_t freq[256], uint8_t lengths[256]) {
+    uint16_t order[256];
+    uint64_t prefix[257] = {};
+    int depths[256], count[256] = {};
+    int n = sortByFrequency(freq, order, lengths);
+    if (n == 0) return true;
+    if (n == 1) {
+        lengths[order[0]] = 1;  // единственный символ получает код из одного бита
+        return true;
+    }
+    for (int i = 0; i < n; ++i) prefix[i + 1] = prefix[i] + freq[order[i]];
+    shannonFanoSplit(prefix, 0, n - 1, 0, depths);
+    int maxLen = 0;
+    for (int i = 0; i < n; ++i) {
+        count[depths[i]]++;
+        maxLen = max(maxLen, depths[i]);
+    }
+    assignLimitedLengths(count, maxLen, order, n, lengths);
+    return true;
+}
+
+unordered_map<char, string> shannonFanoCodes(const size_t freq[256]) {
+    uint8_t lengths[256];
+    shannonFanoLengths(freq, lengths);
+    return codesFromLengths(lengths);
+}
+
+void compressShannonFano(const string& inputFile, const string& outputFile, int lzLevel) {
+    auto t0 = chrono::steady_clock::now();
+    if (!compressFile(inputFile, outputFile, "SFA2", shannonFanoLengths, lzLevel)) return;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cout << "Файл успешно заархивирован (Шеннон-Фано): " << outputFile << endl;
+    printCompressionStats(inputFile, outputFile, seconds);
+}
+
+void decompressShannonFano(const string& inputFile, const string& outputFile) {
+    if (!decompressFile(inputFile, outputFile, "SFA2", "SFAN")) return;
+    cout << "Файл успешно разархивирован (Шеннон-Фано): " << outputFile << endl;
+}
+
+// ===================== 静态字典 =====================
+// Файл словаря: сигнатура HDC1, id u32 — CRC32 следующей за ним таблицы длин, таблица длин.
+// Код строится по частотам всех образцов вместе, и к частоте каждого байта добавляется единица:
+// код есть у всех 256 значений, так что словарь принимает и байты, которых в образцах не было.
+const char DICTIONARY_MAGIC[] = "HDC1";
+
+bool buildDictionary(const size_t counts[256], LengthBuilder build, Dictionary& dictionary) {
+    size_t freq[256];
+    for (int s = 0; s < 256; ++s) freq[s] = counts[s] + 1;
+    if (!build(freq, dictionary.lengths)) return false;
+    string table;
+    writeCodeLengths(table, dictionary.lengths);
+    dictionary.id = crc32(reinterpret_cast<const uint8_t*>(table.data()), table.size());
+    canonicalCodes(dictionary.lengths, dictionary.codes);
+    return tableFromLengths(dictionary.lengths, dictionary.decode);
+}
+
+void writeDictionary(const Dictionary& dictionary, string& out) {
+    out.assign(DICTIONARY_MAGIC, 4);
+    putLE(out, dictionary.id, 4);
+    writeCodeLengths(out, dictionary.lengths);
+}
+
+// Словарь из файла в памяти: id сверяется с таблицей, код должен покрывать все 256 байтов и не
+// быть переполненным (сумма Крафта не больше единицы).
+bool readDictionary(span<const uint8_t> bytes, Dictionary& dictionary) {
+    if (bytes.size() < 8 || memcmp(bytes.data(), DICTIONARY_MAGIC, 4) != 0) return false;
+    const uint8_t* p = bytes.data() + 8;
+    const uint8_t* end = bytes.data() + bytes.size();
+    uint32_t id = uint32_t(getLE(bytes.data() + 4, 4));
+    if (crc32(p, size_t(end - p)) != id || !readCodeLengths(p, end, dictionary.lengths) || p != end) return false;
+    uint64_t kraft = 0;
+    for (int s = 0; s < 256; ++s) {
+        if (dictionary.lengths[s] == 0 || dictionary.lengths[s] > HUFFMAN_MAX_LEN) return false;
+        kraft += uint64_t(1) << (HUFFMAN_MAX_LEN - dictionary.lengths[s]);
+    }
+    if (kraft > uint64_t(1) << HUFFMAN_MAX_LEN) return false;
+    dictionary.id = id;
+    canonicalCodes(dictionary.lengths, dictionary.codes);
+    return tableFromLengths(dictionary.lengths, dictionary.decode);
+}
+
+bool loadDictionary(const string& file, Dictionary& dictionary) {
+    MappedInput in;
+    return in.open(file) && readDictionary(in.bytes(), dictionary);
+}
+
+// Обучение: huffandshf -t [-s] -Dсловарь образцы. Образцы — файлы, каталоги, шаблоны и списки, как в
+// пакетном режиме; код строится построителем длин алгоритма (Хаффман или Шеннон-Фано).
+int trainDictionary(const BatchOptions& opt, LengthBuilder build, const string& dictionaryFile) {
+    vector<BatchFile> files;
+    string error;
+    for (const string& input : opt.inputs) {
+        if (!expandBatchInput(input, "", files, error)) {
+            cerr << error << endl;
+            return 2;
+        }
+    }
+    size_t counts[256] = {}, freq[256];
+    uint64_t total = 0;
+    for (const BatchFile& file : files) {
+        MappedInput in;
+        if (!in.open(file.path)) {
+            cerr << "Ошибка открытия файла: " << file.path << endl;
+            return 1;
+        }
+        byteHistogram(in.bytes().data(), in.bytes().size(), freq);
+        for (int s = 0; s < 256; ++s) counts[s] += freq[s];
+        total += in.bytes().size();
+    }
+    if (total == 0) {
+        cerr << "Нет данных для обучения словаря." << endl;
+        return 2;
+    }
+    Dictionary dictionary;
+    string bytes;
+    if (!buildDictionary(counts, build, dictionary)) {
+        cerr << "Не удалось построить словарь." << endl;
+        return 1;
+    }
+    writeDictionary(dictionary, bytes);
+    ofstream out(dictionaryFile, ios::binary);
+    out.write(bytes.data(), bytes.size());
+    if (!out) {
+        cerr << "Ошибка записи файла: " << dictionaryFile << endl;
+        return 1;
+    }
+    uint64_t bits = 0;
+    for (int s = 0; s < 256; ++s) bits += uint64_t(counts[s]) * dictionary.lengths[s];
+    cout << "Словарь " << dictionaryFile << ": id " << dictionaryIdText(dictionary.id) << ", образцов: " << files.size()
+         << ", байт: " << total << ", в среднем " << double(bits) / double(total) << " бит на байт" << endl;
+    return 0;
+}
+
+// ===================== tANS =====================
+// Старого формата у tANS нет, поэтому вместо прежней сигнатуры пустая строка.
+void compressAns(const string& inputFile, const string& outputFile) {
+    auto t0 = chrono::steady_clock::now();
+    if (!compressFile(inputFile, outputFile, "ANS2", TANS_CODER)) return;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+    cout << "Файл успешно заархивирован (tANS): " << outputFile << endl;
+    printCompressionStats(inputFile, outputFile, seconds);
+}
+
+void decompressAns(const string& inputFile, const string& outputFile) {
+    if (!decompressFile(inputFile, outputFile, "ANS2", "")) return;
+    cout << "Файл успешно разархивирован (tANS): " << outputFile << endl;
+}
+
+// ===================== 内存接口 =====================
+// Сжатие и распаковка из буфера в буфер для библиотеки (codec_api.h). Пул и буферы приходят от
+// вызывающего и живут между вызовами, так что повторный вызов не заводит ни потоков, ни таблиц.
+
+// Наибольший размер архива из n байт входа при блоках не короче minBlock. Код символа не длиннее
+// HUFFMAN_MAX_LEN бит, в tANS символ стоит не больше ANS_TABLE_LOG бит, а контекстная модель и
+// LZ77 выбираются, только если они короче; на блок добавляются заголовок, байт модели, таблица
+// (длин — до 289 байт, tANS — до 545) и хвост потока, на архив — заголовок и индекс.
+uint64_t archiveBound(uint64_t n, uint64_t minBlock = 256 * 1024) {
+    const uint64_t blockOverhead = BLOCK_HEADER_SIZE + 1 + 545 + 16 + 8;
+    uint64_t blocks = n / minBlock + 1;
+    return CONTAINER_HEADER_SIZE + 1 + 289 + 4 + 4 + 8 + 4 + blocks * blockOverhead + (n * HUFFMAN_MAX_LEN + 7) / 8;
+}
+
+// Длина распакованных данных архива в памяти по заголовку или индексу, без декодирования.
+bool archiveRawLength(span<const uint8_t> archive, uint64_t& rawLen) {
+    const uint8_t* p = archive.data();
+    const uint8_t* end = p + archive.size();
+    if (archive.size() <= 4) return false;
+    if (!(p[4] & FLAG_BLOCKS)) return singleArchiveLength(p, end, rawLen);
+    uint64_t blockCount;
+    return findBlockIndex(p, end, blockCount, rawLen) != nullptr;
+}
+
+// Поток вывода прямо в буфер вызывающего: запись сверх его размера не проходит, и поток встаёт в ошибку.
+class SpanOutBuf : public streambuf {
+public:
+    explicit SpanOutBuf(span<uint8_t> out) {
+        char* p = reinterpret_cast<char*>(out.data());
+        setp(p, p + out.size());
+    }
+
+    size_t written() const { return size_t(pptr() - pbase()); }
+};
+
+// Архив data в out; в written — его размер. false, если out не хватило (буфер archiveBound
+// байт хватает всегда). archive — буфер архива из одного потока, блоки считаются в pool.
+bool compressInto(span<const uint8_t> data, span<uint8_t> out, size_t& written, const string& magic,
+                  LengthBuilder build, const BlockPolicy& policy, ThreadPool& pool, string& archive) {
+    SpanOutBuf buf(out);
+    ostream stream(&buf);
+    bool ok = compressData(data, stream, magic, build, policy, archive, &pool);
+    written = buf.written();
+    return ok && bool(stream);
+}
+
+// Распаковка архива в памяти в out, блоки — параллельно в pool прямо на свои места; в written —
+// длина данных. idx — разобранный индекс, его буферы переиспользуются. Старый формат
+// (HUFF/SFAN) здесь не читается: у него нет длины в заголовке.
+bool decompressInto(span<const uint8_t> archive, const string& magic, span<uint8_t> out, size_t& written,
+                    ThreadPool& pool, BlockIndex& idx, const Dictionary* dictionary = nullptr) {
+    written = 0;
+    if (archive.size() <= 4 || memcmp(archive.data(), magic.data(), 4) != 0) return false;
+    const uint8_t* p = archive.data();
+    const uint8_t* end = p + archive.size();
+    char* dst = reinterpret_cast<char*>(out.data());
+    uint64_t rawLen;
+    if (p[4] & FLAG_BLOCKS) {
+        if (!parseBlockIndex(p, end, idx, dictionary) || idx.outOffsets.back() > out.size()) return false;
+        rawLen = idx.outOffsets.back();
+        if (!decodeBlocksInto(idx, pool, dst)) return false;
+    }
+    else if (!singleArchiveLength(p, end, rawLen) || rawLen > out.size() ||
+             !decodeSingleInto(p, end, dst, size_t(rawLen), dictionary))
+        return false;
+    written = size_t(rawLen);
+    return true;
+}
+
+// ===================== 性能测试 =====================
+template <class F>
+double timeIt(int rounds, F&& f) {
+    auto t0 = chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) f();
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count() / rounds;
+}
+
+void benchmarkContainer(const string& text, const string& magic, LengthBuilder build, int lzLevel = 0) {
+    const int rounds = 5;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+    double mb = text.size() / 1048576.0;
+    BlockPolicy policy = chooseBlockPolicy(text.size());
+    policy.lzLevel = lzLevel;
+    string archive, restored;
+    double archEnc = timeIt(rounds, [&] { archive = buildArchive(magic, span<const uint8_t>(data, text.size()), build, policy); });
+    double archDec = timeIt(rounds, [&] {
+        decodeArchiveBytes(span<const uint8_t>(reinterpret_cast<const uint8_t*>(archive.data()), archive.size()), magic, restored);
+    });
+    if (lzLevel) cout << "Уровень " << lzLevel;
+    else cout << "Контейнер";
+    cout << " (" << policy.threads << " потоков): сжатие " << mb / archEnc << " МБ/с, распаковка "
+         << mb / archDec << " МБ/с, размер " << archive.size() << " байт ("
+         << 100.0 * double(archive.size()) / double(text.size()) << "%)"
+         << (restored == text ? "" : ", ОШИБКА восстановления") << "\n";
+}
+
+void benchmarkCodes(const string& name, const string& text, unordered_map<char, string> codes,
+                    const string& magic, LengthBuilder build) {
+    CodeEntry table[256];
+    makeEncodeTable(codes, table);
+    vector<PrefixCode> prefixCodes;
+    for (int i = 0; i < 256; ++i)
+        if (table[i].len > 0) prefixCodes.push_back({ static_cast<unsigned char>(i), table[i].code, table[i].len });
+    DecodeTable decodeTable;
+    buildDecodeTable(prefixCodes, decodeTable);
+
+    const int rounds = 5;
+    string legacyPacked, packed, legacyText, fastText;
+    double legacyEnc = timeIt(1, [&] { legacyPacked = encodeBitsLegacy(text, codes); });
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+    size_t freq[256];
+    byteHistogram(data, text.size(), freq);
+    double fastEnc = timeIt(rounds, [&] {
+        packed.clear();
+        encodeBits(data, text.size(), table, encodedBitCount(freq, table), packed);
+    });
+    vector<uint8_t> payload(packed.begin(), packed.end());
+    double legacyDec = timeIt(1, [&] { legacyText = decodeBitsLegacy(prefixCodes, payload); });
+    double fastDec = timeIt(rounds, [&] {
+        fastText.clear();
+        decodeBits(decodeTable, payload.data(), payload.size(), uint64_t(payload.size()) * 8, SIZE_MAX, fastText);
+    });
+
+    double mb = text.size() / 1048576.0;
+    cout << "== " << name << " ==\n";
+    cout << "Результаты совпадают: " << (legacyPacked == packed && legacyText == fastText ? "да" : "НЕТ") << "\n";
+    cout << "Упаковка: было " << mb / legacyEnc << " МБ/с, стало " << mb / fastEnc
+         << " МБ/с (x" << legacyEnc / fastEnc << ")\n";
+    cout << "Распаковка: было " << mb / legacyDec << " МБ/с, стало " << mb / fastDec
+         << " МБ/с (x" << legacyDec / fastDec << ")\n";
+    benchmarkContainer(text, magic, build);
+}
+
+void benchmarkCodecs(const string& inputFile) {
+    string text = readFile(inputFile);
+    if (text.empty()) {
+        cerr << "Ошибка: пустой файл!" << endl;
+        return;
+    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(text.data());
+    size_t freq[256];
+    double mb = text.size() / 1048576.0;
+    double legacyHist = timeIt(5, [&] { countFrequenciesLegacy(data, text.size(), freq); });
+    double fastHist = timeIt(5, [&] { byteHistogram(data, text.size(), freq); });
+    ThreadPool pool(max(1u, thread::hardware_concurrency()));
+    double parallelHist = timeIt(5, [&] { byteHistogram(data, text.size(), freq, pool); });
+    cout << "Гистограмма: было " << mb / legacyHist << " МБ/с, стало " << mb / fastHist << " МБ/с, "
+         << pool.size() << " потоков: " << mb / parallelHist << " МБ/с\n";
+    benchmarkCodes("Хаффман", text, huffmanCodes(freq), "HUF2", huffmanLengths);
+    benchmarkCodes("Шеннон-Фано", text, shannonFanoCodes(freq), "SFA2", shannonFanoLengths);
+    cout << "== tANS ==\n";
+    benchmarkContainer(text, "ANS2", TANS_CODER);
+    cout << "== LZ77 + Хаффман ==\n";
+    for (int level = 1; level <= LZ_MAX_LEVEL; ++level) benchmarkContainer(text, "HUF2", huffmanLengths, level);
+}
+
+// ===================== 批处理 =====================
+// Алгоритм режима без диалога: сигнатура архива, сигнатура старого формата, суффикс пакетного режима.
+struct Codec {
+    string magic;
+    string legacyMagic;
+    string suffix;
+    LengthBuilder build;
+};
+
+const Codec HUFFMAN_CODEC = { "HUF2", "HUFF", ".huf", huffmanLengths };
+const Codec SHANNON_FANO_CODEC = { "SFA2", "SFAN", ".sfa", shannonFanoLengths };
+const Codec TANS_CODEC = { "ANS2", "", ".ans", TANS_CODER };
+
+// Пакетный режим: архив получает суффикс .huf/.sfa/.ans, при распаковке суффикс снимается (если его нет,
+// добавляется .out). Параллельность идёт по файлам: каждый файл кодируется в одном потоке теми же
+// блоками, что и в диалоговом режиме, а буфер архива или распакованных данных остаётся у потока.
+// С collectStats по каждому файлу в stderr уходит строка статистики (stage_stats.h); dictionary — статический
+// словарь для сжатия и распаковки.
+int runBatchMode(const BatchOptions& opt, bool compress, const Codec& codec, int lzLevel, bool collectStats,
+                 const Dictionary* dictionary) {
+    const string& magic = codec.magic;
+    const string& legacyMagic = codec.legacyMagic;
+    const string& suffix = codec.suffix;
+    LengthBuilder build = codec.build;
+    return runBatch(opt, compress ? "" : suffix, [&](const BatchFile& file, BatchReport& report) {
+        thread_local string buffer;
+        StageStats stats;
+        StageScope scope(collectStats ? &stats : nullptr);
+        auto t0 = chrono::steady_clock::now();
+        MappedInput in;
+        bool opened;
+        {
+            StageTimer timer(STAGE_READ);
+            opened = in.open(file.path);
+        }
+        if (!opened) return report.fail(file.path, "ошибка открытия файла");
+        span<const uint8_t> data = in.bytes();
+        if (compress && data.empty()) return report.fail(file.path, "пустой файл");
+
+        string outputFile = batchOutputBase(file, opt.outDir);
+        if (compress) outputFile += suffix;
+        else if (outputFile.size() > suffix.size() && outputFile.ends_with(suffix))
+            outputFile.resize(outputFile.size() - suffix.size());
+        else outputFile += ".out";
+        ofstream out(outputFile, ios::binary);
+        if (!out.is_open()) return report.fail(outputFile, "ошибка записи файла");
+
+        bool ok;
+        if (compress) {
+            BlockPolicy policy = chooseBlockPolicy(data.size());
+            policy.threads = 1;
+            policy.lzLevel = lzLevel;
+            policy.dictionary = dictionary;
+            ok = compressData(data, out, magic, build, policy, buffer);
+        }
+        else ok = decompressData(file.path, data, out, magic, legacyMagic, 1, buffer, dictionary);
+        uintmax_t written = ok ? uintmax_t(out.tellp()) : 0;
+        if (collectStats) {
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+            printStageStats(cerr, "huffandshf", compress ? "compress" : "decompress", file.path, ok, seconds, stats);
+        }
+        string wanted = ok || compress ? "" : missingDictionaryText(data, magic, dictionary);
+        if (!wanted.empty()) return report.fail(file.path, "архив сжат со словарём " + wanted);
+        if (!ok) return report.fail(file.path, compress ? "ошибка сжатия" : "архив повреждён или имеет неверный формат");
+        report.done(data.size(), written);
+    });
+}
+
+// ===================== 主函数 =====================
+// Режим без диалога: huffandshf -c [-s|-a] [-j N] < вход > архив, huffandshf -d [-s|-a] [-j N] < архив > выход,
+// а с файлами, каталогами, шаблонами или списками @файл — пакетный режим (см. runBatchMode).
+// -s — Шеннон-Фано, -a — tANS, без них — Хаффман; -1 ... -9 — уровень LZ77 перед префиксным кодом;
+// -m — строка статистики этапов в stderr на каждый файл (или на весь поток); -Dсловарь — статический
+// словарь для небольших сообщений (Хаффман и Шеннон-Фано), который строит huffandshf -t по образцам.
+int runPipe(int argc, char* argv[]) {
+    BatchOptions opt;
+    string error;
+    if (!parseBatchArgs(argc, argv, opt, error)) {
+        cerr << error << endl;
+        return 2;
+    }
+    bool compress = false, decompress = false, shannonFano = false, ans = false, collectStats = false, train = false;
+    int lzLevel = 0;
+    string dictionaryFile;
+    for (const string& arg : opt.flags) {
+        if (arg == "-c") compress = true;
+        else if (arg == "-t") train = true;
+        else if (arg.size() > 2 && arg.compare(0, 2, "-D") == 0) dictionaryFile = arg.substr(2);
+        else if (arg.size() == 2 && arg[1] >= '1' && arg[1] <= '0' + LZ_MAX_LEVEL) lzLevel = arg[1] - '0';
+        else if (arg == "-d") decompress = true;
+        else if (arg == "-s") shannonFano = true;
+        else if (arg == "-a") ans = true;
+        else if (arg == "-m") collectStats = true;
+        else {
+            cerr << "Неизвестный параметр: " << arg << endl;
+            return 2;
+        }
+    }
+    bool usageOk = train ? !compress && !decompress && !ans && !lzLevel && !dictionaryFile.empty() &&
+                               !opt.inputs.empty() && opt.outDir.empty()
+                         : compress != decompress && !(shannonFano && ans) && !(ans && lzLevel) &&
+                               !(ans && !dictionaryFile.empty()) && !(opt.inputs.empty() && !opt.outDir.empty());
+    if (!usageOk) {
+        cerr << "Использование: huffandshf -c [-s|-a] [-1..-9] [-j N] [-m] [-Dсловарь] < вход > архив | huffandshf -d [-s|-a] [-j N] [-m] [-Dсловарь] < архив > выход\n"
+             << "               huffandshf -c|-d [-s|-a] [-1..-9] [-j N] [-m] [-Dсловарь] [-o каталог] файлы, каталоги, шаблоны, @список\n"
+             << "               huffandshf -t [-s] -Dсловарь образцы, каталоги, шаблоны, @список\n"
+             << "               (-1..-9 — уровень LZ77, только без -a; -m — статистика этапов в stderr;\n"
+             << "                -t — обучить словарь для небольших сообщений, -D — сжимать и распаковывать с ним, только без -a)" << endl;
+        return 2;
+    }
+    const Codec& codec = ans ? TANS_CODEC : shannonFano ? SHANNON_FANO_CODEC : HUFFMAN_CODEC;
+    if (train) return trainDictionary(opt, codec.build, dictionaryFile);
+    Dictionary dictionary;
+    if (!dictionaryFile.empty() && !loadDictionary(dictionaryFile, dictionary)) {
+        cerr << "Не удалось прочитать словарь: " << dictionaryFile << endl;
+        return 2;
+    }
+    const Dictionary* dict = dictionaryFile.empty() ? nullptr : &dictionary;
+    if (!opt.inputs.empty()) return runBatchMode(opt, compress, codec, lzLevel, collectStats, dict);
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ios::sync_with_stdio(false);
+    BlockPolicy policy = streamBlockPolicy();
+    if (opt.jobs) policy.threads = opt.jobs;
+    policy.lzLevel = lzLevel;
+    policy.dictionary = dict;
+    StageStats stats;
+    StageScope scope(collectStats ? &stats : nullptr);
+    auto t0 = chrono::steady_clock::now();
+    string wanted;
+    bool ok = compress
+        ? compressStream(cin, cout, codec.magic, codec.build, policy)
+        : decompressStream(cin, cout, codec.magic, codec.legacyMagic, policy.threads, dict, &wanted);
+    if (collectStats) {
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        printStageStats(cerr, "huffandshf", compress ? "compress" : "decompress", "-", ok, seconds, stats);
+    }
+    if (!wanted.empty()) cerr << "Архив сжат со словарём " << wanted << ", нужен -D с ним!" << endl;
+    else if (!ok) cerr << (compress ? "Ошибка сжатия потока!" : "Архив повреждён или имеет неверный формат!") << endl;
+    return ok ? 0 : 1;
+}
+
+// codec_bench.cpp и библиотека codec_api.cpp включают этот файл целиком ради кодеков и определяют
+// HUFFANDSHF_NO_MAIN.
+#ifndef HUFFANDSHF_NO_MAIN
+int main(int argc, char* argv[]) {
+    if (argc > 1) return runPipe(argc, argv);
+
+    cout << "Выберите действие:\n";
+    cout << "1 - Заархивировать файл\n";
+    cout << "2 - Разархивировать файл\n";
+    cout << "3 - Сравнить скорость старого и нового кодека\n";
+    int choice;
+    cin >> choice;
+
+    string inputFile, outputFile;
+    cout << "Введите имя входного файла: ";
+    cin >> inputFile;
+    if (choice == 3) {
+        benchmarkCodecs(inputFile);
+        return 0;
+    }
+    cout << "Введите имя выходного файла: ";
+    cin >> outputFile;
+
+    if (choice == 1) {
+        cout << "Выберите алгоритм:\n1 - Хаффман\n2 - Шеннон-Фано\n3 - tANS\n";
+        int alg;
+        cin >> alg;
+        int level = 0;
+        if (alg != 3) {
+            cout << "Уровень LZ77 (0 - без поиска повторов, 1-" << LZ_MAX_LEVEL << " - быстрее ... сильнее): ";
+            cin >> level;
+            level = max(0, min(level, LZ_MAX_LEVEL));
+        }
 
         if (alg == 1)
-            compressHuffman(inputFile, outputFile);
+            compressHuffman(inputFile, outputFile, level);
+        else if (alg == 3)
+            compressAns(inputFile, outputFile);
         else
-            compressShannonFano(inputFile, outputFile);
+            compressShannonFano(inputFile, outputFile, level);
     }
     else if (choice == 2) {
-        cout << "Введите тип алгоритма (1 - Хаффман, 2 - Шеннон-Фано): ";
+        cout << "Введите тип алгоритма (1 - Хаффман, 2 - Шеннон-Фано, 3 - tANS): ";
         int alg;
         cin >> alg;
         if (alg == 1)
             decompressHuffman(inputFile, outputFile);
+        else if (alg == 3)
+            decompressAns(inputFile, outputFile);
         else
             decompressShannonFano(inputFile, outputFile);
     }
@@ -349,3 +2679,4 @@ int main() {
 
     return 0;
 }
+#endif
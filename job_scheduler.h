@@ -0,0 +1,65 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Планировщик независимых заданий с перехватом работы. Задания раскладываются по очередям
+// рабочих по кругу; рабочий берёт задания из начала своей очереди, а освободившийся забирает
+// последнее задание из чужой. Если задания упорядочены по убыванию стоимости, каждый рабочий
+// начинает с крупных, а мелкие задания из хвостов очередей выравнивают загрузку в конце.
+class JobScheduler {
+public:
+    explicit JobScheduler(unsigned threads) : queues(std::max(1u, threads)) {}
+
+    unsigned size() const { return unsigned(queues.size()); }
+
+    // body(job, worker): worker — номер рабочего в [0, size()), по нему берутся его буферы.
+    // Вызывающий поток работает рабочим 0 и возвращается, когда выполнены все задания.
+    void run(size_t count, const std::function<void(size_t, unsigned)>& body) {
+        for (size_t i = 0; i < count; ++i) queues[i % queues.size()].jobs.push_back(i);
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < size() && w < count; ++w)
+            threads.emplace_back([this, w, &body] { work(w, body); });
+        work(0, body);
+        for (std::thread& t : threads) t.join();
+    }
+
+private:
+    struct Queue {
+        std::mutex m;
+        std::deque<size_t> jobs;
+    };
+
+    bool popOwn(unsigned w, size_t& job) {
+        Queue& q = queues[w];
+        std::lock_guard<std::mutex> lock(q.m);
+        if (q.jobs.empty()) return false;
+        job = q.jobs.front();
+        q.jobs.pop_front();
+        return true;
+    }
+
+    // Новых заданий во время run не появляется, поэтому пустые очереди у всех означают конец.
+    bool steal(unsigned w, size_t& job) {
+        for (unsigned k = 1; k < size(); ++k) {
+            Queue& q = queues[(w + k) % size()];
+            std::lock_guard<std::mutex> lock(q.m);
+            if (q.jobs.empty()) continue;
+            job = q.jobs.back();
+            q.jobs.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    void work(unsigned w, const std::function<void(size_t, unsigned)>& body) {
+        size_t job;
+        while (popOwn(w, job) || steal(w, job)) body(job, w);
+    }
+
+    std::vector<Queue> queues;
+};
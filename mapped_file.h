@@ -0,0 +1,118 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Входной файл как непрерывный массив байтов. Обычный файл отображается в память только для
+// чтения с подсказкой последовательного доступа; каналы и всё, что не отображается, читаются в буфер.
+class MappedInput {
+public:
+    MappedInput() = default;
+    MappedInput(const MappedInput&) = delete;
+    MappedInput& operator=(const MappedInput&) = delete;
+    ~MappedInput() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+            if (view) {
+                base = static_cast<const uint8_t*>(view);
+                length = size_t(fileSize.QuadPart);
+                isMapped = true;
+                CloseHandle(file);
+                return true;
+            }
+            if (mapping) CloseHandle(mapping);
+            mapping = nullptr;
+        }
+        char chunk[1 << 16];
+        DWORD got = 0;
+        bool ok = true;
+        while ((ok = ReadFile(file, chunk, sizeof(chunk), &got, nullptr) != 0) && got > 0)
+            buffer.insert(buffer.end(), chunk, chunk + got);
+        CloseHandle(file);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                madvise(view, size_t(st.st_size), MADV_SEQUENTIAL);
+                base = static_cast<const uint8_t*>(view);
+                length = size_t(st.st_size);
+                isMapped = true;
+                ::close(fd);
+                return true;
+            }
+        }
+        char chunk[1 << 16];
+        ssize_t got;
+        while ((got = ::read(fd, chunk, sizeof(chunk))) > 0)
+            buffer.insert(buffer.end(), chunk, chunk + got);
+        bool ok = got == 0;
+        ::close(fd);
+#endif
+        base = buffer.data();
+        length = buffer.size();
+        return ok;
+    }
+
+    void close() {
+        if (isMapped) {
+#ifdef _WIN32
+            UnmapViewOfFile(base);
+            CloseHandle(mapping);
+            mapping = nullptr;
+#else
+            munmap(const_cast<uint8_t*>(base), length);
+#endif
+        }
+        isMapped = false;
+        base = nullptr;
+        length = 0;
+        std::vector<uint8_t>().swap(buffer);
+    }
+
+    std::span<const uint8_t> bytes() const { return { base, length }; }
+    bool mapped() const { return isMapped; }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+    bool isMapped = false;
+    std::vector<uint8_t> buffer;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// output — тот же файл, что input (в том числе по другому пути или через ссылку). Запись в такой
+// выход обрезает отображённый вход, и чтение из отображения обрывается SIGBUS, поэтому утилиты
+// отказываются от неё заранее. Несуществующий выход с входом не совпадает.
+inline bool sameFile(const std::string& input, const std::string& output) {
+    std::error_code ec;
+    return std::filesystem::equivalent(input, output, ec);
+}
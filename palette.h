@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "rle.h"
+
+// Изображение с палитрой после перестройки: палитра по 4 байта на цвет (синий, зелёный, красный,
+// ноль), строки по Pixels<bpp>::bytes(width) байт подряд, снизу вверх.
+struct IndexedImage {
+    int bpp = 0;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> pixels;
+};
+
+// Номера различных цветов: открытая адресация на 512 ячеек, цветов не больше 256.
+class ColorIds {
+public:
+    ColorIds() { std::fill(std::begin(ids), std::end(ids), int16_t(-1)); }
+
+    // Номер цвета, новый — следующий по порядку; -1, если это был бы 257-й цвет.
+    int find(uint32_t color) {
+        size_t h = (color * 2654435761u) >> 23;
+        while (ids[h] >= 0 && keys[h] != color) h = (h + 1) & 511;
+        if (ids[h] < 0) {
+            if (count == 256) return -1;
+            keys[h] = color;
+            ids[h] = int16_t(count);
+            colors[count++] = color;
+        }
+        return ids[h];
+    }
+
+    int count = 0;
+    uint32_t colors[256];  // по номеру; синий в младшем байте, как в палитре BMP
+
+private:
+    uint32_t keys[512];
+    int16_t ids[512];
+};
+
+template <int BPP>
+void writeIndexedPixels(const uint8_t* ids, const uint8_t newIndex[256], int width, int height,
+                        std::vector<uint8_t>& pixels) {
+    using P = Pixels<BPP>;
+    size_t rowBytes = P::bytes(width);
+    pixels.assign(rowBytes * size_t(height), 0);
+    for (int r = 0; r < height; ++r) {
+        uint8_t* row = pixels.data() + size_t(r) * rowBytes;
+        const uint8_t* src = ids + size_t(r) * size_t(width);
+        for (int x = 0; x < width; ++x) P::put(row, x, newIndex[src[x]]);
+    }
+}
+
+// Номер цвета каждого пикселя индексированного изображения; индексы за концом палитры считаются
+// отдельными (чёрными) цветами, чтобы не склеиться с настоящими.
+template <int BPP>
+void indexedColorIds(std::span<const uint8_t> palette, RowView rows, int width, int height, ColorIds& colors,
+                     uint8_t* ids) {
+    using P = Pixels<BPP>;
+    uint8_t idOfIndex[256];
+    for (unsigned i = 0; i < (1u << BPP); ++i) {
+        uint32_t color = 0x1000000u | i;
+        if (4 * i + 3 < palette.size())
+            color = palette[4 * i] | uint32_t(palette[4 * i + 1]) << 8 | uint32_t(palette[4 * i + 2]) << 16;
+        idOfIndex[i] = uint8_t(colors.find(color));
+    }
+    for (int r = 0; r < height; ++r) {
+        const uint8_t* row = rows[r];
+        uint8_t* dst = ids + size_t(r) * size_t(width);
+        for (int x = 0; x < width; ++x) dst[x] = idOfIndex[P::get(row, x)];
+    }
+}
+
+// Точная палитра вместо исходной: одинаковые цвета склеиваются в один индекс, неиспользуемые
+// выбрасываются, остальные нумеруются по убыванию частоты. Цвет ни одного пикселя не меняется, но
+// серии, которые рвались на дублях одного цвета (частый след дизеринга и склейки слоёв), становятся
+// длиннее, а 8- и 24-битные изображения с небольшим числом цветов — вдвое и вшестеро короче ещё до
+// сжатия. Порядок индексов на серии не влияет (серия определяется только равенством индексов), так
+// что сортировка лишь ставит частые цвета в начало палитры.
+//
+// Вход — 1, 4 или 8 бит с палитрой либо 24 бита без неё, строки снизу вверх. Глубина результата —
+// 4 бита, если цветов не больше 16, иначе 8; 1-битные остаются 1-битными, а до 1 бита 4- и 8-битные
+// не уменьшаются: RLE1 — собственный код, другие программы его не прочтут. false, если у 24-битного
+// изображения больше 256 цветов. Перенумерация нигде не записывается: сжатый поток с новыми индексами
+// узнаётся только по отличию палитры (samePalette).
+inline bool reducePalette(int bpp, std::span<const uint8_t> palette, RowView rows, int width, int height,
+                          IndexedImage& out) {
+    ColorIds colors;
+    std::vector<uint8_t> ids(size_t(width) * size_t(height));
+    switch (bpp) {
+    case 1: indexedColorIds<1>(palette, rows, width, height, colors, ids.data()); break;
+    case 4: indexedColorIds<4>(palette, rows, width, height, colors, ids.data()); break;
+    case 8: indexedColorIds<8>(palette, rows, width, height, colors, ids.data()); break;
+    default:
+        for (int r = 0; r < height; ++r) {
+            const uint8_t* row = rows[r];
+            uint8_t* dst = ids.data() + size_t(r) * size_t(width);
+            uint32_t last = 0xFFFFFFFFu;  // соседние пиксели чаще всего одного цвета
+            int lastId = 0;
+            for (int x = 0; x < width; ++x, row += 3) {
+                uint32_t color = row[0] | uint32_t(row[1]) << 8 | uint32_t(row[2]) << 16;
+                if (color != last) {
+                    lastId = colors.find(color);
+                    if (lastId < 0) return false;
+                    last = color;
+                }
+                dst[x] = uint8_t(lastId);
+            }
+        }
+    }
+
+    size_t counts[256] = {};
+    for (uint8_t id : ids) counts[id]++;
+    uint8_t order[256], newIndex[256] = {};
+    int used = 0;
+    for (int id = 0; id < colors.count; ++id)
+        if (counts[id]) order[used++] = uint8_t(id);
+    std::sort(order, order + used,
+              [&](uint8_t a, uint8_t b) { return counts[a] != counts[b] ? counts[a] > counts[b] : a < b; });
+    out.palette.assign(size_t(std::max(used, 1)) * 4, 0);
+    for (int k = 0; k < used; ++k) {
+        uint32_t color = colors.colors[order[k]];
+        newIndex[order[k]] = uint8_t(k);
+        if (color >> 24) continue;  // индекс за концом исходной палитры
+        out.palette[4 * size_t(k)] = uint8_t(color);
+        out.palette[4 * size_t(k) + 1] = uint8_t(color >> 8);
+        out.palette[4 * size_t(k) + 2] = uint8_t(color >> 16);
+    }
+
+    out.bpp = bpp == 1 ? 1 : used <= 16 ? 4 : 8;
+    switch (out.bpp) {
+    case 1: writeIndexedPixels<1>(ids.data(), newIndex, width, height, out.pixels); break;
+    case 4: writeIndexedPixels<4>(ids.data(), newIndex, width, height, out.pixels); break;
+    default: writeIndexedPixels<8>(ids.data(), newIndex, width, height, out.pixels); break;
+    }
+    return true;
+}
+
+// Индексы двух изображений значат одни и те же цвета: палитры совпадают побайтно. Перестройка
+// палитры (reducePalette) меняет индексы, не оставляя иных следов в файле, поэтому потоки, строки
+// которых переносятся между изображениями как есть (updateRLE), сверяются по палитре.
+inline bool samePalette(std::span<const uint8_t> a, std::span<const uint8_t> b) {
+    return std::equal(a.begin(), a.end(), b.begin(), b.end());
+}
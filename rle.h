@@ -0,0 +1,689 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include "thread_pool.h"
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RLE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RLE_TARGET_AVX2
+#else
+#define RLE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Коды сжатия в biCompression. Для 1-битных изображений стандартного RLE в BMP нет, поэтому
+// используется собственный код 'RLE1' с той же структурой потока команд.
+const uint32_t BI_RGB = 0, BI_RLE8 = 1, BI_RLE4 = 2, BI_RLE1 = 0x31454C52;
+
+// Упакованные пиксели с BPP битами на пиксель (1, 4 или 8): PERIOD пикселей в байте, левый
+// пиксель в старших битах. Все сдвиги и маски известны при компиляции.
+template <int BPP>
+struct Pixels {
+    static_assert(BPP == 1 || BPP == 4 || BPP == 8, "поддерживаются 1, 4 и 8 бит на пиксель");
+    static constexpr int PERIOD = 8 / BPP;
+    static constexpr uint8_t MASK = uint8_t((1 << BPP) - 1);
+
+    // Индексы неотрицательны; беззнаковое деление на степень двойки — просто сдвиг.
+    static int shift(int x) { return 8 - BPP - int(unsigned(x) % PERIOD) * BPP; }
+    static uint8_t get(const uint8_t* row, int x) { return uint8_t((row[unsigned(x) / PERIOD] >> shift(x)) & MASK); }
+    static void put(uint8_t* row, int x, uint8_t v) {
+        uint8_t& b = row[unsigned(x) / PERIOD];
+        b = uint8_t((b & ~(MASK << shift(x))) | (v << shift(x)));
+    }
+    static size_t bytes(int n) { return (size_t(n) * BPP + 7) / 8; }
+};
+
+// Строки изображения в памяти без копирования: строка r в порядке потока RLE (снизу вверх)
+// начинается с first + r·step. У файлов, хранящих строки сверху вниз, step отрицателен.
+struct RowView {
+    const uint8_t* first = nullptr;
+    ptrdiff_t step = 0;
+
+    RowView() = default;
+    RowView(const uint8_t* first, ptrdiff_t step) : first(first), step(step) {}
+    RowView(std::span<const uint8_t> pixels, size_t stride) : first(pixels.data()), step(ptrdiff_t(stride)) {}
+    const uint8_t* operator[](int r) const { return first + ptrdiff_t(r) * step; }
+};
+
+// Поиск конца серии. Серия в кодированном режиме — это PERIOD пикселей, начиная с x, повторяемых
+// по кругу (в RLE8 — один цвет, в RLE4 — чередование двух, в RLE1 — узор из 8 битов). Возвращается
+// первый пиксель в [x + PERIOD, end), нарушающий повтор, или end. Векторные варианты сравнивают
+// сразу 16/32 упакованных байта с байтом узора серии и находят первую границу через movemask и
+// счёт младших нулей.
+typedef int (*RunScanner)(const uint8_t* row, int x, int end);
+
+template <int BPP>
+int runEndScalar(const uint8_t* row, int x, int end) {
+    using P = Pixels<BPP>;
+    int e = x + P::PERIOD;
+    while (e < end && P::get(row, e) == P::get(row, e - P::PERIOD)) e++;
+    return std::min(e, end);
+}
+
+// Общая часть векторных вариантов: доводит проверку до границы байта и возвращает индекс первого
+// байта для сравнения целиком, либо -1, если серия уже закончилась в *result.
+template <int BPP>
+long runScanStart(const uint8_t* row, int x, int end, int* result) {
+    using P = Pixels<BPP>;
+    int e = x + P::PERIOD;
+    while (e % P::PERIOD != 0 && e < end && P::get(row, e) == P::get(row, e - P::PERIOD)) e++;
+    if (e >= end || e % P::PERIOD != 0) {
+        *result = std::min(e, end);
+        return -1;
+    }
+    return e / P::PERIOD;
+}
+
+// Граница внутри первого несовпавшего байта i: его первые пиксели ещё могут совпадать с узором.
+template <int BPP>
+int runEndInByte(const uint8_t* row, size_t i, uint8_t pattern, int end) {
+    using P = Pixels<BPP>;
+    int p = int(i) * P::PERIOD;
+    for (int k = 0; k < P::PERIOD - 1 && P::get(row, p) == P::get(&pattern, k); ++k) p++;
+    return std::min(p, end);
+}
+
+template <int BPP>
+int runEndBytesTail(const uint8_t* row, size_t i, size_t lastByte, uint8_t pattern, int end) {
+    while (i < lastByte && row[i] == pattern) i++;
+    return i < lastByte ? runEndInByte<BPP>(row, i, pattern, end) : end;
+}
+
+#ifdef RLE_X86
+template <int BPP>
+int runEndSSE2(const uint8_t* row, int x, int end) {
+    int result = 0;
+    long start = runScanStart<BPP>(row, x, end, &result);
+    if (start < 0) return result;
+    uint8_t pattern = row[start - 1];  // последний целый байт перед start целиком лежит в серии
+    size_t i = size_t(start), lastByte = Pixels<BPP>::bytes(end);
+    __m128i splat = _mm_set1_epi8(char(pattern));
+    for (; i + 16 <= lastByte; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+        unsigned diff = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(v, splat))) & 0xFFFFu;
+        if (diff) return runEndInByte<BPP>(row, i + std::countr_zero(diff), pattern, end);
+    }
+    return runEndBytesTail<BPP>(row, i, lastByte, pattern, end);
+}
+
+template <int BPP>
+RLE_TARGET_AVX2 int runEndAVX2(const uint8_t* row, int x, int end) {
+    int result = 0;
+    long start = runScanStart<BPP>(row, x, end, &result);
+    if (start < 0) return result;
+    uint8_t pattern = row[start - 1];
+    size_t i = size_t(start), lastByte = Pixels<BPP>::bytes(end);
+    __m256i splat = _mm256_set1_epi8(char(pattern));
+    for (; i + 32 <= lastByte; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+        unsigned diff = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, splat)));
+        if (diff) return runEndInByte<BPP>(row, i + std::countr_zero(diff), pattern, end);
+    }
+    return runEndBytesTail<BPP>(row, i, lastByte, pattern, end);
+}
+
+inline bool cpuHasAVX2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// Вариант выбирается один раз по возможностям процессора.
+template <int BPP>
+RunScanner bestRunScanner() {
+#ifdef RLE_X86
+    static const RunScanner chosen = cpuHasAVX2() ? runEndAVX2<BPP> : runEndSSE2<BPP>;
+    return chosen;
+#else
+    return runEndScalar<BPP>;
+#endif
+}
+
+// Байт кодированной пары для серии из n пикселей с x: пиксели серии по кругу, начиная с x.
+template <int BPP>
+uint8_t runPattern(const uint8_t* row, int x, int n) {
+    using P = Pixels<BPP>;
+    uint8_t v = 0;
+    for (int k = 0; k < P::PERIOD; ++k) P::put(&v, k, P::get(row, x + k % n));
+    return v;
+}
+
+// Абсолютный режим допускает до 255 пикселей; длина кратна PERIOD, чтобы следующий кусок
+// длинного литерала начинался так же выровненным.
+template <int BPP>
+constexpr int maxLiteral() { return 255 / Pixels<BPP>::PERIOD * Pixels<BPP>::PERIOD; }
+
+// Литерал [start, start + n): абсолютный режим 00 n <пиксели> с выравниванием до слова, а
+// 1–2 пикселя (абсолютный режим требует n >= 3) — обычными кодированными парами.
+template <int BPP>
+void putRLELiteral(const uint8_t* row, int start, int n, std::vector<uint8_t>& out) {
+    using P = Pixels<BPP>;
+    if (n <= 0) return;
+    if (n < 3) {
+        for (int k = 0; k < n; k += P::PERIOD) {
+            int m = std::min(P::PERIOD, n - k);
+            out.push_back(uint8_t(m));
+            out.push_back(runPattern<BPP>(row, start + k, m));
+        }
+        return;
+    }
+    size_t bytes = P::bytes(n), padded = (bytes + 1) & ~size_t(1);
+    size_t at = out.size();
+    out.resize(at + 2 + padded, 0);
+    out[at] = 0;
+    out[at + 1] = uint8_t(n);
+    uint8_t* dst = out.data() + at + 2;
+    const uint8_t* src = row + start / P::PERIOD;
+    int shift = (start % P::PERIOD) * BPP;
+    if (shift == 0) {
+        std::memcpy(dst, src, bytes);
+    }
+    else {
+        int firstOfNext = (start / P::PERIOD + 1) * P::PERIOD;  // первый пиксель байта src[k + 1]
+        for (size_t k = 0; k < bytes; ++k, firstOfNext += P::PERIOD) {
+            uint8_t b = uint8_t(src[k] << shift);
+            if (firstOfNext < start + n) b |= uint8_t(src[k + 1] >> (8 - shift));
+            dst[k] = b;
+        }
+    }
+    int unused = int(bytes * 8) - n * BPP;
+    dst[bytes - 1] &= uint8_t(0xFF << unused);
+}
+
+// Одна строка и конец строки 00 00. Строка режется на серии не длиннее 255 пикселей, затем для
+// каждой серии выбирается кодированная пара или литерал абсолютного режима. Стоимость в битах:
+// пара — 16, каждый пиксель литерала — BPP, заголовок литерала — 16 плюс в среднем 4 на
+// выравнивание до слова. Выбор делается динамическим программированием по сериям с двумя
+// состояниями («последняя серия — пара» / «литерал открыт»), за один проход.
+template <int BPP>
+void encodeRLERow(const uint8_t* row, int width, std::vector<uint8_t>& out,
+                  RunScanner scan = bestRunScanner<BPP>()) {
+    using P = Pixels<BPP>;
+    thread_local std::vector<uint8_t> runs, from;
+    runs.clear();
+    for (int x = 0; x < width;) {
+        int limit = std::min(width, x + 255);
+        int e;
+        if (x + P::PERIOD >= limit) e = limit;
+        else if (P::get(row, x + P::PERIOD) != P::get(row, x)) e = x + P::PERIOD;  // шум: без вызова поиска
+        else e = scan(row, x, limit);
+        runs.push_back(uint8_t(e - x));
+        x = e;
+    }
+
+    // from[i]: бит 0 — в «пару» пришли из литерала, бит 1 — литерал продолжен, а не открыт заново.
+    const long PAIR = 16, LITERAL_OPEN = 20;
+    from.resize(runs.size());
+    long pair = 0, literal = 1L << 40;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        long n = long(runs[i]) * BPP;
+        long viaPair = std::min(pair, literal) + PAIR;
+        long viaLiteral = std::min(pair + LITERAL_OPEN + n, literal + n);
+        from[i] = uint8_t((literal < pair ? 1 : 0) | (literal + n <= pair + LITERAL_OPEN + n ? 2 : 0));
+        pair = viaPair;
+        literal = viaLiteral;
+    }
+    // Обратный проход: from[i] становится 1 для серий в литерале и 0 для пар.
+    bool inLiteral = literal < pair;
+    for (size_t i = runs.size(); i-- > 0;) {
+        bool cur = inLiteral;
+        inLiteral = cur ? (from[i] & 2) != 0 : (from[i] & 1) != 0;
+        from[i] = cur ? 1 : 0;
+    }
+
+    const int MAX_LITERAL = maxLiteral<BPP>();
+    int x = 0, start = 0, pending = 0;
+    for (size_t i = 0; i < runs.size(); ++i) {
+        int n = runs[i];
+        if (from[i]) {
+            if (pending == 0) start = x;
+            pending += n;
+            while (pending >= MAX_LITERAL) {
+                putRLELiteral<BPP>(row, start, MAX_LITERAL, out);
+                start += MAX_LITERAL;
+                pending -= MAX_LITERAL;
+            }
+        }
+        else {
+            putRLELiteral<BPP>(row, start, pending, out);
+            pending = 0;
+            out.push_back(uint8_t(n));
+            out.push_back(runPattern<BPP>(row, x, n));
+        }
+        x += n;
+    }
+    putRLELiteral<BPP>(row, start, pending, out);
+    out.push_back(0);
+    out.push_back(0);
+}
+
+// Заполнение n пикселей строки узором pattern (PERIOD пикселей по кругу) начиная с x: до границы
+// байта по пикселю, затем целыми байтами повернутого узора.
+template <int BPP>
+void fillRLERun(uint8_t* row, int x, int n, uint8_t pattern) {
+    using P = Pixels<BPP>;
+    int k = 0;
+    for (; k < n && (x + k) % P::PERIOD != 0; ++k) P::put(row, x + k, P::get(&pattern, k % P::PERIOD));
+    int whole = (n - k) / P::PERIOD;
+    if (whole > 0) {
+        int r = (k % P::PERIOD) * BPP;
+        uint8_t rotated = r ? uint8_t((pattern << r) | (pattern >> (8 - r))) : pattern;
+        std::memset(row + (x + k) / P::PERIOD, rotated, size_t(whole));
+        k += whole * P::PERIOD;
+    }
+    for (; k < n; ++k) P::put(row, x + k, P::get(&pattern, k % P::PERIOD));
+}
+
+// Распаковка в несжатые строки с шагом stride в порядке хранения (снизу вверх). Поддерживаются
+// все команды: пары, абсолютный режим, конец строки, конец изображения и смещение 00 02 dx dy.
+// Выход за пределы изображения или данных считается ошибкой.
+template <int BPP>
+bool decodeRLE(std::span<const uint8_t> in, int width, int height, size_t stride, std::vector<uint8_t>& pixels) {
+    using P = Pixels<BPP>;
+    pixels.assign(stride * size_t(height), 0);
+    size_t i = 0;
+    int x = 0, y = 0;
+    while (i + 1 < in.size()) {
+        uint8_t n = in[i], v = in[i + 1];
+        i += 2;
+        if (n > 0) {
+            if (y >= height || x + n > width) return false;
+            fillRLERun<BPP>(pixels.data() + size_t(y) * stride, x, n, v);
+            x += n;
+        }
+        else if (v == 0) {
+            x = 0;
+            y++;
+        }
+        else if (v == 1) {
+            return true;
+        }
+        else if (v == 2) {
+            if (i + 1 >= in.size()) return false;
+            x += in[i];
+            y += in[i + 1];
+            i += 2;
+            if (x > width || y > height) return false;
+        }
+        else {
+            size_t bytes = P::bytes(v), padded = (bytes + 1) & ~size_t(1);
+            if (y >= height || x + v > width || i + bytes > in.size()) return false;
+            uint8_t* row = pixels.data() + size_t(y) * stride;
+            int k = 0;
+            if (x % P::PERIOD == 0) {
+                k = v / P::PERIOD * P::PERIOD;
+                std::memcpy(row + x / P::PERIOD, in.data() + i, size_t(v / P::PERIOD));
+            }
+            for (; k < v; ++k) P::put(row, x + k, P::get(in.data() + i, k));
+            x += v;
+            i += std::min(padded, in.size() - i);
+        }
+    }
+    return true;
+}
+
+// Строки независимы, поэтому изображение режется на полосы строк (по нескольку на поток для
+// равномерной загрузки), каждая полоса кодируется в свой буфер, а буферы затем копируются в общий
+// результат по префиксным суммам их размеров. Строки идут в порядке хранения (снизу вверх).
+template <int BPP>
+std::vector<uint8_t> encodeRLEParallel(RowView rows, int width, int height, ThreadPool& pool) {
+    size_t stripes = std::min<size_t>(size_t(height), size_t(pool.size()) * 4);
+    std::vector<std::vector<uint8_t>> parts(stripes);
+    RunScanner scan = bestRunScanner<BPP>();
+    pool.parallelFor(stripes, [&](size_t s) {
+        int first = int(size_t(height) * s / stripes);
+        int last = int(size_t(height) * (s + 1) / stripes);
+        std::vector<uint8_t>& out = parts[s];
+        out.reserve(size_t(last - first) * (Pixels<BPP>::bytes(width) + 2));
+        for (int r = first; r < last; ++r) encodeRLERow<BPP>(rows[r], width, out, scan);
+    });
+
+    std::vector<size_t> offsets(stripes + 1, 0);
+    for (size_t s = 0; s < stripes; ++s) offsets[s + 1] = offsets[s] + parts[s].size();
+    std::vector<uint8_t> result(offsets[stripes] + 2);
+    pool.parallelFor(stripes, [&](size_t s) {
+        if (!parts[s].empty()) std::memcpy(result.data() + offsets[s], parts[s].data(), parts[s].size());
+    });
+    result[offsets[stripes]] = 0;
+    result[offsets[stripes] + 1] = 1;  // конец изображения
+    return result;
+}
+
+// Последовательный вариант для пакетной обработки, где параллельность идёт по файлам: результат
+// пишется в out с начала, ёмкость буфера сохраняется между файлами.
+template <int BPP>
+void encodeRLE(RowView rows, int width, int height, std::vector<uint8_t>& out) {
+    out.clear();
+    RunScanner scan = bestRunScanner<BPP>();
+    for (int r = 0; r < height; ++r) encodeRLERow<BPP>(rows[r], width, out, scan);
+    out.push_back(0);
+    out.push_back(1);  // конец изображения
+}
+
+// Строки подряд с шагом stride.
+template <int BPP>
+std::vector<uint8_t> encodeRLEParallel(std::span<const uint8_t> pixels, int width, int height,
+                                       size_t stride, ThreadPool& pool) {
+    return encodeRLEParallel<BPP>(RowView(pixels, stride), width, height, pool);
+}
+
+template <int BPP>
+void encodeRLE(std::span<const uint8_t> pixels, int width, int height, size_t stride, std::vector<uint8_t>& out) {
+    encodeRLE<BPP>(RowView(pixels, stride), width, height, out);
+}
+
+// Начала строк в потоке, который выдали encodeRLE / encodeRLEParallel (каждая строка кончается
+// 00 00, в конце 00 01): offsets[r] — первая команда строки r, offsets[height] — конец изображения.
+// Идёт только по командам, литералы пропускаются целиком. false, если поток так не разбивается
+// (смещения 00 02, ранний конец изображения, другое число строк).
+template <int BPP>
+bool indexRLERows(std::span<const uint8_t> in, int height, std::vector<size_t>& offsets) {
+    using P = Pixels<BPP>;
+    offsets.assign(1, 0);
+    size_t i = 0;
+    while (offsets.size() <= size_t(height)) {
+        if (i + 1 >= in.size()) return false;
+        uint8_t n = in[i], v = in[i + 1];
+        i += 2;
+        if (n > 0) continue;
+        if (v == 0) offsets.push_back(i);
+        else if (v <= 2) return false;
+        else i += (P::bytes(v) + 1) & ~size_t(1);
+    }
+    return i + 1 < in.size() && in[i] == 0 && in[i + 1] == 1;
+}
+
+// Число пар «длина, узор» в потоке до конца изображения; литералы пропускаются целиком. Нужно
+// только для статистики (stage_stats.h), поэтому кодер сам серии не считает.
+template <int BPP>
+size_t countRLERuns(std::span<const uint8_t> in) {
+    size_t runs = 0;
+    for (size_t i = 0; i + 1 < in.size();) {
+        uint8_t n = in[i], v = in[i + 1];
+        i += 2;
+        if (n > 0) runs++;
+        else if (v == 1) break;
+        else if (v == 2) i += 2;
+        else if (v > 2) i += (Pixels<BPP>::bytes(v) + 1) & ~size_t(1);
+    }
+    return runs;
+}
+
+// Пересжатие после правки: строки newRows, отличающиеся от oldRows, кодируются заново, а
+// остальные копируются из oldEncoded целыми отрезками между изменёнными строками; результат
+// побайтно совпадает с encodeRLE(newRows). Сравнение строк идёт на скорости memcmp, так что
+// время определяется числом изменённых строк. rowOffsets — индекс oldEncoded (пустой строится
+// по командам потока), после вызова — индекс out: редактор, который держит поток в памяти, при
+// следующей правке поток не разбирает. Возвращает число перекодированных строк или -1, если
+// oldEncoded не делится на height строк.
+template <int BPP>
+long updateRLE(RowView oldRows, RowView newRows, int width, int height, std::span<const uint8_t> oldEncoded,
+               std::vector<size_t>& rowOffsets, std::vector<uint8_t>& out) {
+    if (rowOffsets.empty() && !indexRLERows<BPP>(oldEncoded, height, rowOffsets)) return -1;
+    if (rowOffsets.size() != size_t(height) + 1 || rowOffsets.back() + 2 > oldEncoded.size()) return -1;
+
+    thread_local std::vector<size_t> offsets;
+    offsets.assign(1, 0);
+    out.clear();
+    out.reserve(oldEncoded.size());
+    RunScanner scan = bestRunScanner<BPP>();
+    size_t rowBytes = Pixels<BPP>::bytes(width);
+    long changed = 0;
+    for (int r = 0; r < height;) {
+        int same = r;
+        while (same < height && std::memcmp(oldRows[same], newRows[same], rowBytes) == 0) same++;
+        if (same == r) {
+            encodeRLERow<BPP>(newRows[r], width, out, scan);
+            offsets.push_back(out.size());
+            changed++;
+            r++;
+            continue;
+        }
+        size_t at = out.size(), from = rowOffsets[size_t(r)];
+        out.insert(out.end(), oldEncoded.begin() + from, oldEncoded.begin() + rowOffsets[size_t(same)]);
+        for (int k = r + 1; k <= same; ++k) offsets.push_back(rowOffsets[size_t(k)] - from + at);
+        r = same;
+    }
+    out.push_back(0);
+    out.push_back(1);  // конец изображения
+    rowOffsets.swap(offsets);
+    return changed;
+}
+
+template <int BPP>
+long updateRLE(std::span<const uint8_t> oldPixels, std::span<const uint8_t> newPixels, int width, int height,
+               size_t stride, std::span<const uint8_t> oldEncoded, std::vector<size_t>& rowOffsets,
+               std::vector<uint8_t>& out) {
+    return updateRLE<BPP>(RowView(oldPixels, stride), RowView(newPixels, stride), width, height, oldEncoded,
+                          rowOffsets, out);
+}
+
+// Индекс для произвольного доступа к строкам: offsets[k] — начало строки k·step в потоке, последним
+// идёт конец изображения; rows — число строк в потоке. Шаг больше 1 уменьшает индекс, а до нужной
+// строки декодер доходит, пропуская не больше step - 1 строк по одним заголовкам команд.
+struct RLERowIndex {
+    int step = 1;
+    int rows = 0;
+    std::vector<uint64_t> offsets;
+};
+
+// Индекс с шагом step из начал всех строк и конца изображения (rows + 1 смещение, как у indexRLERows
+// и updateRLE): после updateRLE поток заново не разбирается.
+inline bool sampleRLERowIndex(std::span<const size_t> all, int step, RLERowIndex& index) {
+    if (step < 1 || all.empty() || all.size() - 1 > 0x7FFFFFFF) return false;
+    int rows = int(all.size() - 1);
+    index.step = step;
+    index.rows = rows;
+    index.offsets.clear();
+    for (int r = 0; r < rows; r += step) index.offsets.push_back(all[size_t(r)]);
+    index.offsets.push_back(all.back());
+    return true;
+}
+
+template <int BPP>
+bool makeRLERowIndex(std::span<const uint8_t> in, int rows, int step, RLERowIndex& index) {
+    thread_local std::vector<size_t> all;
+    return step >= 1 && indexRLERows<BPP>(in, rows, all) && sampleRLERowIndex(all, step, index);
+}
+
+// Файл индекса рядом с изображением: 'RLX1', шаг, число строк и число смещений по 4 байта, затем
+// смещения по 8 байт; всё little-endian.
+inline void writeRLERowIndex(const RLERowIndex& index, std::vector<uint8_t>& out) {
+    auto put = [&](uint64_t v, int bytes) {
+        for (int k = 0; k < bytes; ++k) out.push_back(uint8_t(v >> (8 * k)));
+    };
+    out.assign({ 'R', 'L', 'X', '1' });
+    put(uint32_t(index.step), 4);
+    put(uint32_t(index.rows), 4);
+    put(uint32_t(index.offsets.size()), 4);
+    for (uint64_t offset : index.offsets) put(offset, 8);
+}
+
+// Проверяет согласованность с потоком длиной streamSize: смещения не убывают и не выходят за поток.
+inline bool readRLERowIndex(std::span<const uint8_t> in, size_t streamSize, RLERowIndex& index) {
+    auto get = [&](size_t at, int bytes) {
+        uint64_t v = 0;
+        for (int k = bytes - 1; k >= 0; --k) v = (v << 8) | in[at + size_t(k)];
+        return v;
+    };
+    if (in.size() < 16 || std::memcmp(in.data(), "RLX1", 4) != 0) return false;
+    uint64_t step = get(4, 4), rows = get(8, 4), count = get(12, 4);
+    if (step < 1 || rows > 0x7FFFFFFF || count != (rows + step - 1) / step + 1 || in.size() != 16 + count * 8)
+        return false;
+    index.step = int(step);
+    index.rows = int(rows);
+    index.offsets.resize(size_t(count));
+    for (size_t k = 0; k < count; ++k) {
+        index.offsets[k] = get(16 + 8 * k, 8);
+        if (index.offsets[k] > streamSize || (k > 0 && index.offsets[k] < index.offsets[k - 1])) return false;
+    }
+    return true;
+}
+
+// Одна строка с позиции pos до конца строки 00 00 (pos встаёт за него) в row: пиксели пишутся
+// только в [0, xEnd), дальше команды лишь пропускаются; xEnd = 0 — только найти следующую строку.
+// Ранний конец изображения оставляет строку пустой. Смещения 00 02 в индексированном потоке не
+// встречаются и считаются ошибкой.
+template <int BPP>
+bool decodeRLERow(std::span<const uint8_t> in, size_t& pos, int width, int xEnd, uint8_t* row) {
+    using P = Pixels<BPP>;
+    std::memset(row, 0, P::bytes(xEnd));
+    int x = 0;
+    while (pos + 1 < in.size()) {
+        uint8_t n = in[pos], v = in[pos + 1];
+        pos += 2;
+        if (n > 0) {
+            if (x + n > width) return false;
+            if (x < xEnd) fillRLERun<BPP>(row, x, std::min<int>(n, xEnd - x), v);
+            x += n;
+        }
+        else if (v == 0) {
+            return true;
+        }
+        else if (v == 1) {
+            pos = in.size();
+            return true;
+        }
+        else if (v == 2) {
+            return false;
+        }
+        else {
+            size_t padded = (P::bytes(v) + 1) & ~size_t(1);
+            if (x + v > width || pos + P::bytes(v) > in.size()) return false;
+            int m = std::clamp(xEnd - x, 0, int(v)), k = 0;
+            if (x % P::PERIOD == 0) {
+                k = m / P::PERIOD * P::PERIOD;
+                std::memcpy(row + x / P::PERIOD, in.data() + pos, size_t(m / P::PERIOD));
+            }
+            for (; k < m; ++k) P::put(row, x + k, P::get(in.data() + pos, k));
+            x += v;
+            pos += std::min(padded, in.size() - pos);
+        }
+    }
+    return true;
+}
+
+// Прямоугольник [x, x + w) × [y, y + h) в строках хранения (снизу вверх) — в tile: h строк с шагом
+// tileStride, пиксель x становится первым в строке. Разбираются только строки прямоугольника (от
+// ближайшей строки индекса) и в каждой пиксели пишутся только до x + w, так что время зависит от
+// размера фрагмента, а не изображения. Строки делятся на полосы между потоками pool, если он есть;
+// строки за концом потока (index.rows) остаются нулевыми, как в decodeRLE.
+template <int BPP>
+bool decodeRLERect(std::span<const uint8_t> in, const RLERowIndex& index, int width, int x, int y, int w, int h,
+                   size_t tileStride, ThreadPool* pool, std::vector<uint8_t>& tile) {
+    using P = Pixels<BPP>;
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || x > width - w || tileStride < P::bytes(w) || index.step < 1 ||
+        index.offsets.size() != size_t((index.rows + index.step - 1) / index.step) + 1)
+        return false;
+    tile.assign(tileStride * size_t(h), 0);
+    int last = std::min(y + h, index.rows);
+    if (y >= last) return true;
+
+    size_t stripes = pool ? std::min<size_t>(size_t(last - y), size_t(pool->size()) * 4) : 1;
+    std::atomic<bool> ok{ true };
+    auto body = [&](size_t s) {
+        thread_local std::vector<uint8_t> row;
+        row.resize(P::bytes(width));
+        int first = y + int(size_t(last - y) * s / stripes), end = y + int(size_t(last - y) * (s + 1) / stripes);
+        size_t pos = size_t(index.offsets[size_t(first / index.step)]);
+        for (int r = first / index.step * index.step; r < end; ++r) {
+            bool wanted = r >= first;
+            if (!decodeRLERow<BPP>(in, pos, width, wanted ? x + w : 0, row.data())) {
+                ok = false;
+                return;
+            }
+            if (!wanted) continue;
+            uint8_t* dst = tile.data() + size_t(r - y) * tileStride;
+            if (x % P::PERIOD == 0) std::memcpy(dst, row.data() + x / P::PERIOD, P::bytes(w));
+            else
+                for (int k = 0; k < w; ++k) P::put(dst, k, P::get(row.data(), x + k));
+            int unused = int(P::bytes(w) * 8) - w * BPP;
+            dst[P::bytes(w) - 1] &= uint8_t(0xFF << unused);
+        }
+    };
+    if (pool) pool->parallelFor(stripes, body);
+    else body(0);
+    return ok;
+}
+
+// Выбор специализации по biBitCount для вызова из утилит.
+inline uint32_t rleCompression(int bpp) {
+    return bpp == 8 ? BI_RLE8 : bpp == 4 ? BI_RLE4 : BI_RLE1;
+}
+
+inline std::vector<uint8_t> encodeRLEParallel(int bpp, RowView rows, int width, int height, ThreadPool& pool) {
+    switch (bpp) {
+    case 1: return encodeRLEParallel<1>(rows, width, height, pool);
+    case 4: return encodeRLEParallel<4>(rows, width, height, pool);
+    default: return encodeRLEParallel<8>(rows, width, height, pool);
+    }
+}
+
+inline void encodeRLE(int bpp, RowView rows, int width, int height, std::vector<uint8_t>& out) {
+    switch (bpp) {
+    case 1: return encodeRLE<1>(rows, width, height, out);
+    case 4: return encodeRLE<4>(rows, width, height, out);
+    default: return encodeRLE<8>(rows, width, height, out);
+    }
+}
+
+inline bool decodeRLE(int bpp, std::span<const uint8_t> in, int width, int height, size_t stride,
+                      std::vector<uint8_t>& pixels) {
+    switch (bpp) {
+    case 1: return decodeRLE<1>(in, width, height, stride, pixels);
+    case 4: return decodeRLE<4>(in, width, height, stride, pixels);
+    default: return decodeRLE<8>(in, width, height, stride, pixels);
+    }
+}
+
+inline size_t countRLERuns(int bpp, std::span<const uint8_t> in) {
+    switch (bpp) {
+    case 1: return countRLERuns<1>(in);
+    case 4: return countRLERuns<4>(in);
+    default: return countRLERuns<8>(in);
+    }
+}
+
+inline long updateRLE(int bpp, RowView oldRows, RowView newRows, int width, int height,
+                      std::span<const uint8_t> oldEncoded, std::vector<size_t>& rowOffsets, std::vector<uint8_t>& out) {
+    switch (bpp) {
+    case 1: return updateRLE<1>(oldRows, newRows, width, height, oldEncoded, rowOffsets, out);
+    case 4: return updateRLE<4>(oldRows, newRows, width, height, oldEncoded, rowOffsets, out);
+    default: return updateRLE<8>(oldRows, newRows, width, height, oldEncoded, rowOffsets, out);
+    }
+}
+
+inline bool makeRLERowIndex(int bpp, std::span<const uint8_t> in, int rows, int step, RLERowIndex& index) {
+    switch (bpp) {
+    case 1: return makeRLERowIndex<1>(in, rows, step, index);
+    case 4: return makeRLERowIndex<4>(in, rows, step, index);
+    default: return makeRLERowIndex<8>(in, rows, step, index);
+    }
+}
+
+inline bool decodeRLERect(int bpp, std::span<const uint8_t> in, const RLERowIndex& index, int width, int x, int y,
+                          int w, int h, size_t tileStride, ThreadPool* pool, std::vector<uint8_t>& tile) {
+    switch (bpp) {
+    case 1: return decodeRLERect<1>(in, index, width, x, y, w, h, tileStride, pool, tile);
+    case 4: return decodeRLERect<4>(in, index, width, x, y, w, h, tileStride, pool, tile);
+    default: return decodeRLERect<8>(in, index, width, x, y, w, h, tileStride, pool, tile);
+    }
+}
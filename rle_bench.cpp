@@ -0,0 +1,238 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include "rle.h"
+#include "palette.h"
+
+// Замер кодера RLE на синтетических 4-битных изображениях: старый попиксельный цикл getPixel (только
+// пары) против построчного кодера со скалярным, SSE2 и AVX2 поиском серий, и декодер; затем обновление
+// после небольшой правки, чтение фрагмента по индексу строк, параллельные кодер и декодер для 1- и
+// 8-битных изображений. Каждый результат проверяется распаковкой.
+
+uint8_t getPixel(std::span<const uint8_t> data, int width, int x, int y, int height) {
+    int rowBytes = (width + 1) / 2;
+    int rowIndex = height - 1 - y;
+    uint8_t byte = data[rowIndex * rowBytes + x / 2];
+    return (x % 2 == 0) ? (byte >> 4) : (byte & 0x0F);
+}
+
+std::vector<uint8_t> encodeRLE4Legacy(std::span<const uint8_t> data, int width, int height) {
+    std::vector<uint8_t> encoded;
+    for (int y = height - 1; y >= 0; y--) {
+        int x = 0;
+        while (x < width) {
+            uint8_t color = getPixel(data, width, x, y, height);
+            int count = 1;
+            while (x + count < width && getPixel(data, width, x + count, y, height) == color && count < 255)
+                count++;
+            encoded.push_back(count);
+            encoded.push_back((color << 4) | color);
+            x += count;
+        }
+        encoded.push_back(0);
+        encoded.push_back(0);
+    }
+    encoded.push_back(0);
+    encoded.push_back(1);
+    return encoded;
+}
+
+std::vector<uint8_t> encodeSerial(std::span<const uint8_t> data, int width, int height, RunScanner scan) {
+    size_t stride = size_t(width + 1) / 2;
+    std::vector<uint8_t> encoded;
+    for (int r = 0; r < height; ++r) encodeRLERow<4>(data.data() + size_t(r) * stride, width, encoded, scan);
+    encoded.push_back(0);
+    encoded.push_back(1);
+    return encoded;
+}
+
+// kind: 0 - длинные горизонтальные серии, 1 - шум, 2 - серии с пятнами шума
+template <int BPP = 4>
+std::vector<uint8_t> makeImage(int width, int height, int kind) {
+    using P = Pixels<BPP>;
+    size_t stride = P::bytes(width);
+    std::vector<uint8_t> data(stride * height);
+    std::mt19937 rng(12345);
+    for (int r = 0; r < height; ++r) {
+        uint8_t color = uint8_t(rng() & P::MASK);
+        int runLeft = 0;
+        for (int x = 0; x < width; ++x) {
+            uint8_t pixel;
+            if (kind == 1 || (kind == 2 && (x / 64 + r / 64) % 3 == 0)) {
+                pixel = uint8_t(rng() & P::MASK);
+            }
+            else {
+                if (runLeft-- <= 0) {
+                    color = uint8_t(rng() & P::MASK);
+                    runLeft = 8 + int(rng() % 600);
+                }
+                pixel = color;
+            }
+            P::put(data.data() + size_t(r) * stride, x, pixel);
+        }
+    }
+    return data;
+}
+
+template <class F>
+double timeIt(int rounds, F&& f) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() / rounds;
+}
+
+// Параллельные кодер и декодер для 1-битных (RLE1) и 8-битных (BI_RLE8) изображений.
+template <int BPP>
+void benchOtherDepth(int width, int height, int rounds) {
+    const char* names[] = { "Длинные серии", "Шум", "Смешанное" };
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    for (int kind = 0; kind < 3; ++kind) {
+        std::vector<uint8_t> image = makeImage<BPP>(width, height, kind);
+        std::span<const uint8_t> data(image);
+        size_t stride = Pixels<BPP>::bytes(width);
+        double mb = image.size() / 1048576.0;
+        std::vector<uint8_t> encoded, decoded;
+        double t = timeIt(rounds, [&] { encoded = encodeRLEParallel<BPP>(data, width, height, stride, pool); });
+        bool ok = decodeRLE<BPP>(encoded, width, height, stride, decoded) && decoded == image;
+        std::cout << "== " << BPP << " бит, " << names[kind] << " (" << image.size() << " байт) ==\n";
+        std::cout << "параллельно: " << mb / t << " МБ/с, " << encoded.size() << " байт"
+                  << (ok ? "" : ", ОШИБКА восстановления") << "\n";
+        t = timeIt(rounds, [&] { decodeRLE<BPP>(encoded, width, height, stride, decoded); });
+        std::cout << "распаковка: " << mb / t << " МБ/с\n";
+    }
+}
+
+// Обновление после небольшой правки (несколько изменённых строк) против полного сжатия: updateRLE с
+// индексом строк, построенным заново по старому потоку, и с индексом, сохранённым с прошлого раза.
+void benchUpdate(int width, int height, int rounds) {
+    std::vector<uint8_t> before = makeImage(width, height, 2), after = before;
+    size_t stride = Pixels<4>::bytes(width);
+    for (int r : { 7, height / 3, height / 2, height / 2 + 1, height - 1 })
+        for (int x = 100; x < 140; ++x) Pixels<4>::put(after.data() + size_t(r) * stride, x, uint8_t(x & 15));
+    std::vector<uint8_t> oldEncoded, full, updated;
+    encodeRLE<4>(before, width, height, stride, oldEncoded);
+    double tFull = timeIt(rounds, [&] { encodeRLE<4>(after, width, height, stride, full); });
+    std::vector<size_t> index;
+    long changed = 0;
+    double tIndexed = timeIt(rounds, [&] {
+        index.clear();
+        changed = updateRLE<4>(before, after, width, height, stride, oldEncoded, index, updated);
+    });
+    bool ok = updated == full;
+    std::vector<size_t> oldIndex;
+    indexRLERows<4>(oldEncoded, height, oldIndex);
+    double tKept = timeIt(rounds, [&] {
+        index = oldIndex;
+        updateRLE<4>(before, after, width, height, stride, oldEncoded, index, updated);
+    });
+    ok = ok && updated == full;
+    std::cout << "== Правка " << changed << " строк из " << height << " ==\n";
+    std::cout << "полное сжатие: " << tFull * 1e3 << " мс\n";
+    std::cout << "обновление: " << tIndexed * 1e3 << " мс (x" << tFull / tIndexed << "), с готовым индексом: "
+              << tKept * 1e3 << " мс (x" << tFull / tKept << ")" << (ok ? "" : ", ОШИБКА: поток отличается") << "\n";
+}
+
+// Обновление поверх файла, сжатого с перестройкой палитры (-p у BMPyasuo/bmpyasuo): reducePalette
+// нумерует цвета заново, и строки, скопированные из такого потока, под палитрой нового файла стали бы
+// другими цветами. Утилиты сверяют палитры (samePalette) и отвергают такое обновление; здесь проверяется,
+// что перестройка палитры сверку не проходит и что без неё поток действительно вышел бы неверным.
+void checkUpdateAfterPaletteRebuild() {
+    const int width = 20, height = 6;
+    size_t stride = Pixels<4>::bytes(width);
+    std::vector<uint8_t> palette(16 * 4, 0), before(stride * height);
+    for (int c = 0; c < 16; ++c) palette[4 * c] = palette[4 * c + 1] = palette[4 * c + 2] = uint8_t(c * 16);
+    for (int r = 0; r < height; ++r)
+        for (int x = 0; x < width; ++x) Pixels<4>::put(before.data() + size_t(r) * stride, x, x < 10 ? 15 : 3);
+    std::vector<uint8_t> after = before;
+    for (int x = 0; x < 5; ++x) Pixels<4>::put(after.data() + 2 * stride, x, 7);
+
+    IndexedImage rebuilt;
+    std::vector<uint8_t> rebuiltEncoded, full, updated;
+    std::vector<size_t> index;
+    bool ok = reducePalette(4, palette, RowView(before, stride), width, height, rebuilt) && rebuilt.bpp == 4;
+    encodeRLE<4>(rebuilt.pixels, width, height, stride, rebuiltEncoded);
+    encodeRLE<4>(after, width, height, stride, full);
+    updateRLE<4>(before, after, width, height, stride, rebuiltEncoded, index, updated);
+    bool rejected = ok && !samePalette(palette, rebuilt.palette);
+    std::cout << "== Обновление поверх сжатого с -p ==\n";
+    std::cout << (rejected ? "палитра перестроена, обновление отвергается" : "ОШИБКА: перестройка палитры не замечена")
+              << (updated != full ? "" : ", ОШИБКА: поток без сверки совпал") << "\n";
+}
+
+// Окно просмотра большой 4-битной карты: decodeRLE целиком против decodeRLERect фрагмента 512x512 с
+// полным и разреженным индексом строк; фрагмент сверяется с полной распаковкой.
+void benchTile(int rounds) {
+    const int width = 8000, height = 8000, tileX = 3001, tileY = 5000, tileSize = 512;
+    std::vector<uint8_t> image = makeImage(width, height, 2), encoded, full, tile;
+    size_t stride = Pixels<4>::bytes(width), tileStride = Pixels<4>::bytes(tileSize);
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    encoded = encodeRLEParallel<4>(image, width, height, stride, pool);
+    double tFull = timeIt(rounds, [&] { decodeRLE<4>(encoded, width, height, stride, full); });
+    std::cout << "== Фрагмент " << tileSize << "x" << tileSize << " из " << width << "x" << height << " ==\n";
+    std::cout << "распаковка целиком: " << tFull * 1e3 << " мс\n";
+    for (int step : { 1, 16 }) {
+        RLERowIndex index;
+        makeRLERowIndex<4>(encoded, height, step, index);
+        double t = timeIt(rounds, [&] {
+            decodeRLERect<4>(encoded, index, width, tileX, tileY, tileSize, tileSize, tileStride, &pool, tile);
+        });
+        bool ok = true;
+        for (int r = 0; r < tileSize; ++r)
+            for (int x = 0; x < tileSize; ++x)
+                ok = ok && Pixels<4>::get(tile.data() + size_t(r) * tileStride, x) ==
+                               Pixels<4>::get(full.data() + size_t(tileY + r) * stride, tileX + x);
+        std::cout << "индекс каждой " << step << "-й строки (" << index.offsets.size() * 8 << " байт): " << t * 1e3
+                  << " мс (x" << tFull / t << ")" << (ok ? "" : ", ОШИБКА восстановления") << "\n";
+    }
+}
+
+int main() {
+    const int width = 4001, height = 2000, rounds = 5;
+    const char* names[] = { "Длинные серии", "Шум", "Смешанное" };
+    struct Variant { const char* name; RunScanner scan; };
+    std::vector<Variant> variants = { { "скалярный", runEndScalar<4> } };
+#ifdef RLE_X86
+    variants.push_back({ "SSE2", runEndSSE2<4> });
+    if (cpuHasAVX2()) variants.push_back({ "AVX2", runEndAVX2<4> });
+#endif
+
+    for (int kind = 0; kind < 3; ++kind) {
+        std::vector<uint8_t> image = makeImage(width, height, kind);
+        std::span<const uint8_t> data(image);
+        size_t stride = size_t(width + 1) / 2;
+        double mb = image.size() / 1048576.0;
+        auto check = [&](const std::vector<uint8_t>& encoded) {
+            std::vector<uint8_t> decoded;
+            return decodeRLE<4>(encoded, width, height, stride, decoded) && decoded == image;
+        };
+        std::vector<uint8_t> legacyEncoded;
+        double legacy = timeIt(rounds, [&] { legacyEncoded = encodeRLE4Legacy(data, width, height); });
+        std::cout << "== " << names[kind] << " (" << width << "x" << height << ", " << image.size() << " байт) ==\n";
+        std::cout << "getPixel: " << mb / legacy << " МБ/с, " << legacyEncoded.size() << " байт"
+                  << (check(legacyEncoded) ? "" : ", ОШИБКА восстановления") << "\n";
+        std::vector<uint8_t> encoded;
+        for (const Variant& v : variants) {
+            double t = timeIt(rounds, [&] { encoded = encodeSerial(data, width, height, v.scan); });
+            std::cout << v.name << ": " << mb / t << " МБ/с (x" << legacy / t << "), " << encoded.size() << " байт"
+                      << (check(encoded) ? "" : ", ОШИБКА восстановления") << "\n";
+        }
+        ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        double t = timeIt(rounds, [&] { encoded = encodeRLEParallel<4>(data, width, height, stride, pool); });
+        std::cout << "параллельно (" << pool.size() << " потоков): " << mb / t << " МБ/с (x" << legacy / t << ")"
+                  << (check(encoded) ? "" : ", ОШИБКА восстановления") << "\n";
+        std::vector<uint8_t> decoded;
+        t = timeIt(rounds, [&] { decodeRLE<4>(encoded, width, height, stride, decoded); });
+        std::cout << "распаковка: " << mb / t << " МБ/с\n";
+    }
+    benchUpdate(width, height, rounds);
+    benchTile(rounds);
+    checkUpdateAfterPaletteRebuild();
+    benchOtherDepth<1>(width, height, rounds);
+    benchOtherDepth<8>(width, height, rounds);
+    return 0;
+}
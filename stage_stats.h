@@ -0,0 +1,188 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+#if defined(STAGE_STATS_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define STAGE_STATS_PROBE(name, stage) DTRACE_PROBE1(codec, name, stage)
+#endif
+#endif
+#ifndef STAGE_STATS_PROBE
+#define STAGE_STATS_PROBE(name, stage) ((void)0)
+#endif
+
+// Счётчики и время этапов обработки одного файла. Сбор включается для потока объектом StageScope
+// (утилиты — по флагу -m); без него таймер и счётчик — одна проверка thread_local указателя, а
+// ThreadPool переносит указатель в свои рабочие потоки на время задания. Этапы вложенные, время
+// каждого — собственное, без вложенных этапов, и суммируется по всем потокам, так что при
+// параллельной обработке сумма этапов может превышать общее время.
+//
+// Сборка с -DSTAGE_STATS_SDT (и <sys/sdt.h>) добавляет статические точки codec:stage_begin и
+// codec:stage_end с номером этапа: perf probe / perf record -e sdt_codec:* показывает границы
+// этапов и без -m, а в обычной сборке точек нет вовсе.
+enum Stage {
+    STAGE_READ,     // чтение входа
+    STAGE_PARSE,    // разбор заголовков
+    STAGE_COUNT,    // подсчёт частот
+    STAGE_BUILD,    // длины кодов, таблицы кодера и декодера
+    STAGE_MATCH,    // поиск повторов LZ77
+    STAGE_ENCODE,   // кодирование и упаковка битов
+    STAGE_DECODE,   // декодирование
+    STAGE_CRC,      // контрольные суммы
+    STAGE_PALETTE,  // перестройка палитры
+    STAGE_INDEX,    // индекс строк RLE
+    STAGE_WRITE,    // запись результата
+    STAGE_TOTAL
+};
+
+inline const char* const STAGE_NAMES[STAGE_TOTAL] = { "read",   "parse", "count",   "build", "match", "encode",
+                                                      "decode", "crc",   "palette", "index", "write" };
+
+enum StatCounter {
+    STAT_BYTES_IN,
+    STAT_BYTES_OUT,
+    STAT_SYMBOLS,      // символов через энтропийный кодер или пикселей через RLE
+    STAT_RUNS,         // пар RLE «длина, узор»
+    STAT_ALLOCATIONS,  // вызовов operator new
+    STAT_TOTAL
+};
+
+inline const char* const STAT_NAMES[STAT_TOTAL] = { "bytes_in", "bytes_out", "symbols", "runs", "allocations" };
+
+struct StageStats {
+    std::atomic<uint64_t> nanoseconds[STAGE_TOTAL];
+    std::atomic<uint64_t> counters[STAT_TOTAL];
+    std::atomic<int> maxCodeLen{ 0 };  // наибольшая длина построенного префиксного кода
+};
+
+struct StageContext {
+    StageStats* stats = nullptr;
+    int stage = -1;  // текущий этап потока или -1
+    std::chrono::steady_clock::time_point since;
+};
+
+inline thread_local StageContext stageContext;
+
+inline StageStats* activeStageStats() { return stageContext.stats; }
+
+// Сбор в stats (nullptr — выключен) для текущего потока на время жизни объекта.
+class StageScope {
+public:
+    explicit StageScope(StageStats* stats) : saved(stageContext) { stageContext = { stats, -1, {} }; }
+    ~StageScope() { stageContext = saved; }
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+private:
+    StageContext saved;
+};
+
+// Время от создания до разрушения идёт этапу stage; этап, внутри которого создан таймер, на это
+// время останавливается.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage(stage) {
+        STAGE_STATS_PROBE(stage_begin, int(stage));
+        StageContext& c = stageContext;
+        if (!c.stats) return;
+        auto now = std::chrono::steady_clock::now();
+        if (c.stage >= 0) charge(c, now);
+        parent = c.stage;
+        c.stage = stage;
+        c.since = now;
+        active = true;
+    }
+
+    ~StageTimer() {
+        STAGE_STATS_PROBE(stage_end, int(stage));
+        if (!active) return;
+        StageContext& c = stageContext;
+        auto now = std::chrono::steady_clock::now();
+        charge(c, now);
+        c.stage = parent;
+        c.since = now;
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    static void charge(const StageContext& c, std::chrono::steady_clock::time_point now) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - c.since).count();
+        c.stats->nanoseconds[c.stage].fetch_add(uint64_t(ns), std::memory_order_relaxed);
+    }
+
+    Stage stage;
+    int parent = -1;
+    bool active = false;
+};
+
+inline void stageCount(StatCounter counter, uint64_t n) {
+    if (StageStats* s = stageContext.stats) s->counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void noteCodeLength(int length) {
+    StageStats* s = stageContext.stats;
+    if (!s) return;
+    int seen = s->maxCodeLen.load(std::memory_order_relaxed);
+    while (length > seen && !s->maxCodeLen.compare_exchange_weak(seen, length, std::memory_order_relaxed)) {}
+}
+
+inline void noteCodeLengths(const uint8_t lengths[256]) {
+    if (!stageContext.stats) return;
+    int maxLen = 0;
+    for (int i = 0; i < 256; ++i) maxLen = lengths[i] > maxLen ? lengths[i] : maxLen;
+    noteCodeLength(maxLen);
+}
+
+// Строка JSON на файл, целиком одной записью (строки параллельных файлов не перемешиваются):
+// {"tool":...,"op":...,"file":...,"ok":...,"ms":общее время,"bytes_in":...,...,"stages_ms":{...}}
+inline void printStageStats(std::ostream& out, const char* tool, const char* operation, const std::string& file,
+                            bool ok, double seconds, const StageStats& stats) {
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3);
+    line << "{\"tool\":\"" << tool << "\",\"op\":\"" << operation << "\",\"file\":\"";
+    for (unsigned char ch : file) {
+        if (ch == '"' || ch == '\\') line << '\\' << char(ch);
+        else if (ch < 0x20) line << "\\u00" << "0123456789abcdef"[ch >> 4] << "0123456789abcdef"[ch & 15];
+        else line << char(ch);
+    }
+    line << "\",\"ok\":" << (ok ? "true" : "false") << ",\"ms\":" << seconds * 1e3;
+    for (int c = 0; c < STAT_TOTAL; ++c) line << ",\"" << STAT_NAMES[c] << "\":" << stats.counters[c].load();
+    line << ",\"max_code_len\":" << stats.maxCodeLen.load() << ",\"stages_ms\":{";
+    for (int s = 0; s < STAGE_TOTAL; ++s)
+        line << (s ? ",\"" : "\"") << STAGE_NAMES[s] << "\":" << double(stats.nanoseconds[s].load()) / 1e6;
+    line << "}}\n";
+    static std::mutex m;
+    std::lock_guard<std::mutex> lock(m);
+    out << line.str() << std::flush;
+}
+
+// Подсчёт выделений памяти: глобальный operator new заменяется здесь, поэтому заголовок включается
+// в одну единицу трансляции программы (утилиты собираются из одного файла). Библиотеки и программы
+// из нескольких файлов определяют STAGE_STATS_NO_ALLOCATION_HOOK и считают выделения сами.
+// Замены не встраиваются: иначе GCC видит free для памяти из operator new и предупреждает.
+#ifndef STAGE_STATS_NO_ALLOCATION_HOOK
+#ifdef _MSC_VER
+#define STAGE_STATS_NOINLINE __declspec(noinline)
+#else
+#define STAGE_STATS_NOINLINE __attribute__((noinline))
+#endif
+STAGE_STATS_NOINLINE void* operator new(std::size_t size) {
+    stageCount(STAT_ALLOCATIONS, 1);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+STAGE_STATS_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+STAGE_STATS_NOINLINE void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "stage_stats.h"
+
+// Пул потоков фиксированного размера. parallelFor раздаёт индексы [0, count) через общий
+// счётчик; вызывающий поток работает наравне с рабочими и возвращается, когда всё сделано.
+// Сбор статистики вызывающего потока (stage_stats.h) на время задания включается и у рабочих.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads) {
+        for (unsigned i = 1; i < threads; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    unsigned size() const { return unsigned(workers.size()) + 1; }
+
+    void parallelFor(size_t count, const std::function<void(size_t)>& body) {
+        if (workers.empty() || count <= 1) {
+            for (size_t i = 0; i < count; ++i) body(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m);
+            job = &body;
+            jobStats = activeStageStats();
+            jobCount = count;
+            next = 0;
+            pending = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        runItems(body, count);
+        std::unique_lock<std::mutex> lock(m);
+        done.wait(lock, [this] { return pending == 0; });
+        job = nullptr;
+    }
+
+private:
+    void runItems(const std::function<void(size_t)>& body, size_t count) {
+        for (size_t i = next++; i < count; i = next++) body(i);
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        for (;;) {
+            std::unique_lock<std::mutex> lock(m);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            const std::function<void(size_t)>* body = job;
+            size_t count = jobCount;
+            StageScope scope(jobStats);
+            lock.unlock();
+
+            runItems(*body, count);
+
+            lock.lock();
+            if (--pending == 0) done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex m;
+    std::condition_variable wake, done;
+    const std::function<void(size_t)>* job = nullptr;
+    StageStats* jobStats = nullptr;
+    size_t jobCount = 0;
+    std::atomic<size_t> next{ 0 };
+    size_t pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};